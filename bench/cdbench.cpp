@@ -0,0 +1,286 @@
+#include "engine/cddrive.hpp"
+#include "engine/filesystem.hpp"
+#include <stdio.h>
+#include <string.h>
+
+// runs the cd code against a disc image on a simulated drive and reports
+// simulated load times, nothing here sleeps. usage: cdbench [image [file...]]
+// (PSXRP.bin and the files rally.xml puts on it by default), exits non zero
+// if a check fails
+
+using namespace ENGINE;
+
+static constexpr int NUM_REQUESTS  = 48;
+static constexpr int NUM_STREAMS   = 4;
+static constexpr uint32_t MAX_SECTORS = 16;
+static constexpr uint32_t SMALL_READ  = 256; // like walking a header or table
+static const char *const DEFAULT_FILES[] = {"SYSTEM.CNF", "SCUS_000.00", "DIR3/FILE2"};
+
+static uint32_t seed = 1;
+static uint32_t nextRandom(uint32_t range) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % range;
+}
+
+static int failures = 0;
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+struct Batch {
+    CDRequest requests[NUM_REQUESTS];
+    TEMPLATES::UniquePtr<uint32_t[]> buffers[NUM_REQUESTS];
+
+    // random reads all over the disc, like several subsystems loading at once
+    void init(uint32_t numSectors) {
+        for (auto &request : requests) {
+            int i = &request - requests;
+            uint32_t count = 1 + nextRandom(MAX_SECTORS);
+            if (count > numSectors)
+                count = numSectors;
+
+            request.lba        = nextRandom(numSectors - count + 1);
+            request.numSectors = count;
+            request.priority   = (i % 3) ? CD_PRIORITY_NORMAL : CD_PRIORITY_BACKGROUND;
+            buffers[i].reset(new uint32_t[count * (CONST::SECTOR_SIZE / 4)]);
+            request.output = buffers[i].get();
+        }
+    }
+
+    bool verify(const uint8_t *disc) const {
+        for (auto &request : requests)
+            if ((request.state != CD_REQUEST_DONE) || memcmp(request.output, disc + request.lba * CONST::SECTOR_SIZE, request.numSectors * CONST::SECTOR_SIZE))
+                return false;
+        return true;
+    }
+};
+
+// a huge disc full of nothing that reads instantly, for checks about
+// ordering where requests must not merge
+class EmptyDrive : public CDDrive {
+public:
+    bool read(uint32_t lba, void *ptr, int numSectors) {head = lba + numSectors; return true;}
+    bool readSectors(uint32_t lba, void *const *ptrs, int numSectors) {head = lba + numSectors; return true;}
+    uint32_t getHeadLBA(void) const {return head;}
+    bool readAsync(uint32_t lba, void *ptr, int numSectors) {head = lba + numSectors; return true;}
+    bool readSectorsAsync(uint32_t lba, void *const *ptrs, int numSectors) {head = lba + numSectors; return true;}
+    CDAsyncState pollAsync(void) {return CD_ASYNC_DONE;}
+private:
+    uint32_t head = 0;
+};
+
+struct LoadedFile {
+    File *file;
+    const char *path;
+    TEMPLATES::UniquePtr<uint32_t[]> data, async;
+    uint32_t length;
+    AsyncReadHandle handle;
+    bool asyncdone;
+};
+
+static void onLoaded(void *arg, void *buffer, uint32_t length) {
+    auto loaded = reinterpret_cast<LoadedFile *>(arg);
+    loaded->asyncdone = (length == loaded->length);
+}
+
+static void report(const char *name, GENERIC::SimCDDrive &drive) {
+    printf(
+        "%-12s %8.3fs %6u seeks %6u sectors\n",
+        name, double(drive.getSimulatedUS()) / 1000000.0, drive.getSeeks(), drive.getSectorsRead()
+    );
+}
+
+int main(int argc, char **argv) {
+    const char *path = (argc > 1) ? argv[1] : "PSXRP.bin";
+
+    GENERIC::SimCDDrive drive;
+    if (!drive.open(path)) {
+        printf("can't open %s\n", path);
+        return 1;
+    }
+    drive.setTimeScale(0.0f);
+
+    uint32_t numSectors = drive.getNumSectors();
+    TEMPLATES::UniquePtr<uint32_t[]> disc(new uint32_t[numSectors * (CONST::SECTOR_SIZE / 4)]);
+    if (!drive.read(0, disc.get(), int(numSectors))) {
+        printf("can't read %s\n", path);
+        return 1;
+    }
+    auto discdata = reinterpret_cast<const uint8_t *>(disc.get());
+
+    // the same batch in arrival order, through the scheduler blocking and
+    // through it without blocking like ISOFileSystem does
+    {
+        Batch batch;
+        seed = 1;
+        batch.init(numSectors);
+        drive.read(0, batch.buffers[0].get(), 1); //every run starts with the head at the start
+        drive.resetStats();
+
+        for (auto &request : batch.requests) {
+            bool ok = drive.read(request.lba, request.output, int(request.numSectors));
+            request.state = ok ? CD_REQUEST_DONE : CD_REQUEST_FAILED;
+        }
+        report("fifo", drive);
+        check(batch.verify(discdata), "fifo data");
+    }
+    {
+        Batch batch;
+        seed = 1;
+        batch.init(numSectors);
+        drive.read(0, batch.buffers[0].get(), 1); //every run starts with the head at the start
+        drive.resetStats();
+
+        CDScheduler scheduler(&drive);
+        for (auto &request : batch.requests)
+            scheduler.submit(&request);
+        scheduler.flush();
+
+        auto &stats = scheduler.getStats();
+        report("scheduled", drive);
+        printf("             %u runs, %u requests merged, %u gap sectors\n", stats.runs, stats.merged, stats.gapsectors);
+        check(batch.verify(discdata), "scheduled data");
+        check(scheduler.isIdle(), "scheduler idle after flush");
+    }
+    {
+        Batch batch;
+        seed = 1;
+        batch.init(numSectors);
+        drive.read(0, batch.buffers[0].get(), 1); //every run starts with the head at the start
+        drive.resetStats();
+
+        CDScheduler scheduler(&drive);
+        for (auto &request : batch.requests)
+            scheduler.submit(&request);
+        while (scheduler.update()) {}
+
+        report("async", drive);
+        check(batch.verify(discdata), "async data");
+    }
+
+    // requests that waited a long time must still never get ahead of a
+    // stream: age a batch that can't merge, then every run must serve a
+    // stream until they're all done
+    {
+        EmptyDrive empty;
+        CDScheduler scheduler(&empty);
+        CDRequest requests[NUM_REQUESTS], streams[NUM_STREAMS];
+        static uint32_t buffer[CONST::SECTOR_SIZE / 4];
+
+        for (int i = 0; i < NUM_REQUESTS; i++) {
+            requests[i].lba        = uint32_t(i) * (CONST::CD_MAX_RUN_SECTORS * 4);
+            requests[i].numSectors = 1;
+            requests[i].output     = buffer;
+            requests[i].priority   = (i % 3) ? CD_PRIORITY_NORMAL : CD_PRIORITY_BACKGROUND;
+            scheduler.submit(&requests[i]);
+        }
+        for (uint32_t i = 0; i < CONST::CD_AGING_SERVICES * 4; i++)
+            scheduler.service();
+
+        for (int i = 0; i < NUM_STREAMS; i++) {
+            streams[i].lba        = uint32_t(i) * (CONST::CD_MAX_RUN_SECTORS * 4) + (CONST::CD_MAX_RUN_SECTORS * 2);
+            streams[i].numSectors = 1;
+            streams[i].output     = buffer;
+            streams[i].priority   = CD_PRIORITY_STREAM;
+            scheduler.submit(&streams[i]);
+        }
+        for (int i = 0; i < NUM_STREAMS; i++)
+            scheduler.service();
+
+        bool served = true;
+        for (auto &stream : streams)
+            served = served && (stream.state == CD_REQUEST_DONE);
+        check(served, "streams served before aged requests");
+        scheduler.flush();
+    }
+
+    // the filesystem on top: every file read a bit at a time through the
+    // sector cache, then all of them at once as async reads like the asset
+    // manager does, which go through the scheduler
+    {
+        const char *const *paths = DEFAULT_FILES;
+        int numfiles = sizeof(DEFAULT_FILES) / sizeof(DEFAULT_FILES[0]);
+        if (argc > 2) {
+            paths    = argv + 2;
+            numfiles = argc - 2;
+        }
+
+        ISOFileSystem fs(&drive);
+        TEMPLATES::UniquePtr<LoadedFile[]> files(new LoadedFile[numfiles]);
+        drive.resetStats();
+
+        for (int i = 0; i < numfiles; i++) {
+            auto &loaded = files[i];
+            loaded.path  = paths[i];
+            loaded.file  = fs.findFile(paths[i]);
+            check(loaded.file, paths[i]);
+            if (!loaded.file)
+                continue;
+
+            loaded.length = uint32_t(loaded.file->getSize());
+            loaded.data.reset(new uint32_t[(loaded.length + 3) / 4 + 1]);
+            loaded.async.reset(new uint32_t[(loaded.length + 3) / 4 + 1]);
+
+            uint64_t start = drive.getSimulatedUS();
+            fs.getCache().resetStats();
+
+            auto output = reinterpret_cast<uint8_t *>(loaded.data.get());
+            uint32_t total = 0;
+            while (total < loaded.length) {
+                uint32_t length = (loaded.length - total < SMALL_READ) ? (loaded.length - total) : SMALL_READ;
+                if (loaded.file->read(output + total, length) != length)
+                    break;
+                total += length;
+            }
+            check(total == loaded.length, "small reads");
+
+            auto &cache = fs.getCache();
+            printf(
+                "%-20s %9u bytes %8.3fs, cache %u hits %u misses %u read ahead\n",
+                loaded.path, loaded.length, double(drive.getSimulatedUS() - start) / 1000000.0,
+                cache.getHits(), cache.getMisses(), cache.getReadAheads()
+            );
+        }
+        report("small reads", drive);
+
+        drive.read(0, disc.get(), 1); //every run starts with the head at the start
+        drive.resetStats();
+        fs.getCache().invalidate();
+        fs.getScheduler().resetStats();
+
+        for (int i = 0; i < numfiles; i++) {
+            auto &loaded = files[i];
+            loaded.asyncdone = false;
+            loaded.handle    = 0;
+            if (loaded.file) {
+                loaded.handle = fs.queueRead(loaded.file, loaded.async.get(), loaded.length, 0, onLoaded, &loaded);
+                check(loaded.handle, "queueing a read");
+            }
+        }
+        for (bool pending = true; pending;) {
+            fs.update();
+
+            pending = false;
+            for (int i = 0; i < numfiles; i++)
+                pending = pending || fs.isReadPending(files[i].handle);
+        }
+
+        auto &stats = fs.getScheduler().getStats();
+        report("async reads", drive);
+        printf("             %u runs, %u requests merged, %u gap sectors\n", stats.runs, stats.merged, stats.gapsectors);
+
+        for (int i = 0; i < numfiles; i++) {
+            auto &loaded = files[i];
+            if (loaded.file) {
+                check(loaded.asyncdone && !memcmp(loaded.data.get(), loaded.async.get(), loaded.length), loaded.path);
+                delete loaded.file;
+            }
+        }
+    }
+
+    printf(failures ? "%d check(s) failed\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}
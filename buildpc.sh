@@ -1,6 +1,5 @@
 #am i a idiot? yes
-rm -r build &&
+python makeassets.py -o build/pc-debug/assets &&
 cmake --preset pc-debug &&
 cmake --build build/pc-debug &&
-python makeassets.py -o build/pc-debug/assets &&
 ./build/pc-debug/main
\ No newline at end of file
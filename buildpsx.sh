@@ -1,5 +1,5 @@
 #am i a idiot? yes
-rm -r build &&
+python makeassets.py -o build/psx-debug/assets &&
 cmake --preset psx-debug &&
 cmake --build build/psx-debug &&
 mkpsxiso -y rally.xml &&
@@ -1,46 +1,243 @@
 import argparse
-from pathlib import Path
-from tools.convertImage import convert_image
+import hashlib
+import json
+import os
+import re
 import shutil
+from concurrent.futures import ProcessPoolExecutor
+from pathlib import Path
+from tools.compressLZ import LEVELS
+from tools.makeBundle import make_bundle, write_manifest
 
 # Path to the assets folder
 ASSET_PATH = Path(__file__).parent / "assets"
+TOOLS_PATH = Path(__file__).parent / "tools"
+# the asset id header, next to the game's sources so it can be included
+MANIFEST_PATH = Path(__file__).parent / "src" / "assetmanifest.hpp"
 
 # Global list of all visible files, ignoring hidden files and folders
 SRCFILES = [f for f in ASSET_PATH.rglob("*") if f.is_file() and all(not p.startswith(".") for p in f.parts)]
 
+# outputs are rebuilt only when the hash of their inputs and of the
+# converter scripts changes, bump this if the cache layout does
+CACHE_VERSION = 2
+CACHE_FILE    = ".assetcache.json"
+
+# the scripts each kind of job depends on, editing one rebuilds its outputs
+CONVERTERS = {
+    "image": ["convertImage.py", "common.py"],
+    "sound": ["convertAudio.py", "common.py"],
+    "model": ["convertModel.py", "simplifyModel.py", "convertImage.py", "common.py"],
+    "copy":  [],
+    "atlas": ["makeAtlas.py", "convertImage.py"],
+    "bundle": ["makeBundle.py", "compressLZ.py"],
+}
+
 def parse_args():
     parser = argparse.ArgumentParser()
     parser.add_argument("-o", "--output", help="Output folder", required=True)
+    parser.add_argument("-m", "--manifest", help="Where to write the asset id header (default: src/assetmanifest.hpp)")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(), help="Conversions to run at once")
+    parser.add_argument("-f", "--force", action="store_true", help="Ignore the cache and rebuild everything")
+    parser.add_argument("-l", "--level", choices=[*LEVELS, "none"], default="normal", help="Bundle compression, none stores everything as is")
     return parser.parse_args()
 
+# the textures a model embeds, found through its mtl files
+def model_dependencies(obj_path):
+    deps = []
+    with open(obj_path, "r") as f:
+        mtls = [line.split(maxsplit=1)[1].strip() for line in f if line.startswith("mtllib")]
+
+    for mtl in mtls:
+        mtl_path = obj_path.parent / mtl
+        deps.append(mtl_path)
+        if not mtl_path.is_file():
+            continue
+
+        for match in re.finditer(r"^\s*map_Kd\s+(.+?)\s*$", mtl_path.read_text(), re.MULTILINE):
+            tex = obj_path.parent / match.group(1)
+            deps += [tex, tex.with_suffix(".vram")]
+
+    return deps
+
+def hash_files(paths):
+    h = hashlib.sha256()
+    for path in paths:
+        h.update(str(path).encode())
+        if path.is_file():
+            h.update(path.read_bytes())
+        else:
+            h.update(b"\0missing")
+    return h.hexdigest()
+
+# runs in a worker process, the converters are imported here so a worker
+# only pays for the ones it actually uses
+def build(kind, src, out_file, placement = None):
+    if kind == "image":
+        from tools.convertImage import convert_image
+        convert_image(src, placement or src.with_suffix(".vram"), out_file)
+    elif kind == "sound":
+        from tools.convertAudio import convert_audio
+        convert_audio(src, out_file)
+    elif kind == "model":
+        from tools.convertModel import convert_model
+        # the textures were converted next to the model in the first pass
+        convert_model(src, out_file, out_file.parent)
+    else:
+        shutil.copy2(src, out_file)
+
+# pngs without a .vram file get packed by the closest .atlas scene above them
+def find_scenes():
+    scenes = {}
+    for f in SRCFILES:
+        if f.suffix.lower() == ".atlas":
+            if f.parent in scenes:
+                raise SystemExit(f"{scenes[f.parent]} and {f} are in the same folder")
+            scenes[f.parent] = f
+
+    textures = {}
+    for f in SRCFILES:
+        if (f.suffix.lower() != ".png") or f.with_suffix(".vram").is_file():
+            continue
+        scene = next((scenes[d] for d in f.parents if d in scenes), None)
+        if scene is not None:
+            textures.setdefault(scene, []).append(f)
+
+    return textures
+
+def load_cache(path):
+    try:
+        cache = json.loads(path.read_text())
+    except (OSError, ValueError):
+        return {}
+    return cache if cache.get("version") == CACHE_VERSION else {}
+
 def main():
     args = parse_args()
     output_path = Path(args.output).resolve()
+    output_path.mkdir(parents=True, exist_ok=True)
 
     print(f"Output folder: {output_path}")
 
+    cache_path = output_path / CACHE_FILE
+    cache      = {} if args.force else load_cache(cache_path)
+    outputs    = cache.get("outputs", {})
+
+    # everything that ends up in the output folder also goes into the
+    # bundle, named the way the game asks for it
+    built   = {}
+    sources = {}
+    keys    = {}
+    jobs    = []
+
+    versions = { kind: hash_files([TOOLS_PATH / s for s in scripts]) for kind, scripts in CONVERTERS.items() }
+
+    # texture placement has to be decided for a whole scene at once, before
+    # any of its textures can be converted
+    atlases    = {}
+    placements = {}
+    for scene, textures in find_scenes().items():
+        textures = sorted(textures)
+        rel = scene.relative_to(ASSET_PATH).as_posix()
+        key = versions["atlas"] + hash_files([scene, *textures])
+
+        cached = cache.get("atlases", {}).get(rel, {})
+        if cached.get("key") != key:
+            from tools.makeAtlas import read_scene, make_atlas
+            print("Packing", scene)
+            packed = make_atlas(read_scene(scene), textures)
+            cached = { "key": key, "placements": { p.relative_to(ASSET_PATH).as_posix(): v for p, v in packed.items() } }
+
+        atlases[rel] = cached
+        placements.update({ ASSET_PATH / p: v for p, v in cached["placements"].items() })
+
+    def add_built(out_file, rel, src, kind, deps = (), placement = None, extra = ""):
+        if out_file in sources:
+            raise SystemExit(f"{sources[out_file]} and {src} both build {out_file}")
+        built[out_file]   = rel
+        sources[out_file] = src
+
+        key = versions[kind] + hash_files([src, *deps]) + extra
+        keys[rel.as_posix()] = key
+        if (outputs.get(rel.as_posix()) != key) or not out_file.is_file():
+            out_file.parent.mkdir(parents=True, exist_ok=True)
+            jobs.append((kind, src, out_file, rel, placement))
+
     for f in SRCFILES:
         relfile = f.relative_to(ASSET_PATH)
 
         if f.suffix.lower() == ".png":
             # build output path with same structure
-            out_file = output_path / relfile.with_suffix(".xtex")
-            out_file.parent.mkdir(parents=True, exist_ok=True)
-
-            convert_image(f, f.with_suffix(".vram"), out_file)
-
-            print("Converted image", f)
-        #skip
-        elif f.suffix.lower() in (".vram", ".obj", ".mtl"):
+            placement = placements.get(f)
+            add_built(output_path / relfile.with_suffix(".xtex"), relfile.with_suffix(".xtex"), f, "image", [f.with_suffix(".vram")], placement, json.dumps(placement))
+        elif f.suffix.lower() == ".wav":
+            add_built(output_path / relfile.with_suffix(".xsnd"), relfile.with_suffix(".xsnd"), f, "sound")
+        elif f.suffix.lower() == ".obj":
+            # uvs depend on where the textures were packed
+            deps = model_dependencies(f)
+            add_built(output_path / relfile.with_suffix(".xmdl"), relfile.with_suffix(".xmdl"), f, "model", deps, extra = json.dumps([placements.get(d) for d in deps]))
+        #skip, read by the image and model converters
+        elif f.suffix.lower() in (".vram", ".mtl", ".atlas"):
             continue
         else:
             #copy file if dont have to convert
-            out_file = output_path / relfile
-            out_file.parent.mkdir(parents=True, exist_ok=True)
+            add_built(output_path / relfile, relfile, f, "copy")
+
+    # models embed their converted textures, so they go in a second pass
+    passes = [
+        [job for job in jobs if job[0] != "model"],
+        [job for job in jobs if job[0] == "model"],
+    ]
+    print(f"{len(jobs)} of {len(built)} assets out of date")
+
+    failed = []
+    if jobs:
+        with ProcessPoolExecutor(max_workers = max(1, min(args.jobs, len(jobs)))) as pool:
+            for batch in passes:
+                futures = [(job, pool.submit(build, job[0], job[1], job[2], job[4])) for job in batch]
+                for (kind, src, out_file, rel, _), future in futures:
+                    try:
+                        future.result()
+                    except (Exception, SystemExit) as e:
+                        failed.append(src)
+                        outputs.pop(rel.as_posix(), None)
+                        print(f"Failed to convert {src}: {e}")
+                        continue
+
+                    outputs[rel.as_posix()] = keys[rel.as_posix()]
+                    if kind != "copy":
+                        print(f"Converted {kind}", src)
+
+    # only what is still in the tree stays in the cache
+    outputs = { rel: key for rel, key in outputs.items() if rel in keys }
+    cache   = { "version": CACHE_VERSION, "outputs": outputs, "atlases": atlases, "bundle": cache.get("bundle", {}) }
+
+    if failed:
+        cache_path.write_text(json.dumps(cache, indent = 1))
+        raise SystemExit(f"{len(failed)} assets failed to convert")
+
+    # the bundle only has to be repacked if something in it changed
+    files       = { ("assets" / rel).as_posix(): out for out, rel in built.items() }
+    bundle_path = output_path / "assets.xbnl"
+    bundle_key  = hashlib.sha256(json.dumps([sorted(outputs.items()), versions["bundle"], args.level]).encode()).hexdigest()
+
+    if (cache["bundle"].get("key") == bundle_key) and bundle_path.is_file():
+        entries = [tuple(e) for e in cache["bundle"]["entries"]]
+        print(f"Bundle up to date ({len(entries)} assets)")
+    else:
+        entries = make_bundle(files, bundle_path, None if args.level == "none" else args.level)
+        cache["bundle"] = { "key": bundle_key, "entries": entries }
+        length  = sum(e[3] for e in entries)
+        packed  = sum(e[4] or e[3] for e in entries)
+        print(f"Bundled {len(entries)} assets, {length // 1024}k packed to {packed // 1024}k")
+
+    cache_path.write_text(json.dumps(cache, indent = 1))
 
-            shutil.copy2(f, out_file)
+    manifest_path = Path(args.manifest).resolve() if args.manifest else MANIFEST_PATH
+    manifest_path.parent.mkdir(parents=True, exist_ok=True)
+    if write_manifest(entries, manifest_path):
+        print("Wrote manifest", manifest_path)
 
 
 if __name__ == "__main__":
-    main()
\ No newline at end of file
+    main()
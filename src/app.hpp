@@ -1,10 +1,12 @@
 #pragma once 
 
 #include "engine/common.hpp"
+#include "engine/timer.hpp"
 
 class APP {
 public:
   	ENGINE::TEMPLATES::UniquePtr<ENGINE::COMMON::Scene> curscene;
+  	ENGINE::FixedStepScheduler scheduler;
 };
 
 extern APP g_app;
\ No newline at end of file
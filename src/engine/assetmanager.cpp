@@ -1,5 +1,8 @@
 #include "assetmanager.hpp"
-#include "hash.hpp"
+#include "filesystem.hpp"
+#include "timer.hpp"
+#include <string.h>
+#include <stdio.h>
 
 namespace ENGINE {
 
@@ -13,6 +16,601 @@ namespace ENGINE {
         return *instance;
     }
 
+    static constexpr uint32_t BUNDLE_MAGIC = 'X' | ('B' << 8) | ('N' << 16) | ('L' << 24);
+    static constexpr uint32_t CHUNK_SIZE   = uint32_t(ENGINE::CONST::ASSET_CHUNK_SECTORS) * ENGINE::CONST::SECTOR_SIZE;
+
+    AssetManager::AssetManager(void) : usecounter(0), reading(nullptr), bundle(nullptr), numbundleentries(0) {
+        for (auto &stat : stats)
+            stat = {};
+        stats[ASSET_MEMORY_RAM].budget  = ENGINE::CONST::ASSET_BUDGET_RAM;
+        stats[ASSET_MEMORY_VRAM].budget = ENGINE::CONST::ASSET_BUDGET_VRAM;
+        stats[ASSET_MEMORY_SPU].budget  = ENGINE::CONST::ASSET_BUDGET_SPU;
+    }
+
+    AssetEntry *AssetManager::findEntry(uint32_t id) {
+        for (auto &entry : loadedassets)
+            if (entry.ptr && (entry.ptr->getID() == id))
+                return &entry;
+        return nullptr;
+    }
+
+    AssetRequest *AssetManager::findRequest(uint32_t id) {
+        for (auto &request : requests)
+            if ((request.state != ASSET_STATE_NONE) && (request.id == id))
+                return &request;
+        return nullptr;
+    }
+
+    bool AssetManager::store(const Asset *asset) {
+        AssetEntry *slot = nullptr;
+        AssetEntry *victim = nullptr;
+
+        for (auto &entry : loadedassets) {
+            if (!entry.ptr) {
+                slot = &entry;
+                break;
+            }
+            if (!entry.refcount && (!victim || ((usecounter - entry.lastuse) > (usecounter - victim->lastuse))))
+                victim = &entry;
+        }
+
+        // out of slots, make room by dropping the oldest cached asset
+        if (!slot) {
+            if (!victim)
+                return false;
+            for (int type = 0; type < ASSET_MEMORY_COUNT; type++)
+                if (victim->ptr->getMemory(AssetMemory(type)))
+                    stats[type].evictions++;
+            unload(victim);
+            slot = victim;
+        }
+
+        slot->ptr      = asset;
+        slot->refcount = 1;
+        slot->lastuse  = ++usecounter;
+
+        for (int type = 0; type < ASSET_MEMORY_COUNT; type++) {
+            auto &stat = stats[type];
+            stat.used += asset->getMemory(AssetMemory(type));
+            if (stat.used > stat.peak)
+                stat.peak = stat.used;
+        }
+
+        trim();
+        return true;
+    }
+
+    void AssetManager::unload(AssetEntry *entry) {
+        for (int type = 0; type < ASSET_MEMORY_COUNT; type++)
+            stats[type].used -= entry->ptr->getMemory(AssetMemory(type));
+
+        delete entry->ptr;
+        entry->ptr = nullptr;
+    }
+
+    bool AssetManager::trim(void) {
+        bool fits = true;
+
+        for (int type = 0; type < ASSET_MEMORY_COUNT; type++) {
+            while (stats[type].used > stats[type].budget) {
+                // only evicting something that uses this kind of memory helps
+                AssetEntry *victim = nullptr;
+                for (auto &entry : loadedassets)
+                    if (
+                        entry.ptr && !entry.refcount &&
+                        entry.ptr->getMemory(AssetMemory(type)) &&
+                        (!victim || ((usecounter - entry.lastuse) > (usecounter - victim->lastuse)))
+                    )
+                        victim = &entry;
+
+                if (!victim) {
+                    printf("asset memory %d over budget: %u/%u bytes in use\n", type, stats[type].used, stats[type].budget);
+                    fits = false;
+                    break;
+                }
+
+                for (int other = 0; other < ASSET_MEMORY_COUNT; other++)
+                    if (victim->ptr->getMemory(AssetMemory(other)))
+                        stats[other].evictions++;
+                unload(victim);
+            }
+        }
+
+        return fits;
+    }
+
+    void AssetManager::setBudget(AssetMemory type, uint32_t bytes) {
+        stats[type].budget = bytes;
+        trim();
+    }
+
+    void AssetManager::resetStats(void) {
+        for (auto &stat : stats) {
+            stat.peak      = stat.used;
+            stat.evictions = 0;
+        }
+    }
+
+    void AssetManager::purge(void) {
+        for (auto &entry : loadedassets)
+            if (entry.ptr && !entry.refcount)
+                unload(&entry);
+    }
+
+    const Asset *AssetManager::_get(const char *path, const Asset* (*loader)(const char *)) {
+        uint32_t id = ENGINE::HASH::FromString(path);
+
+        auto entry = findEntry(id);
+        if (entry) {
+            entry->refcount++;
+            entry->lastuse = ++usecounter;
+            return entry->ptr;
+        }
+
+        auto asset = loader(path);
+        if (!asset)
+            return nullptr;
+        if (!store(asset)) {
+            delete asset;
+            return nullptr;
+        }
+        return asset;
+    }
+
+    //bundle
+    bool AssetManager::openBundle(const char *path) {
+        // an async load may still be reading from the old one
+        if (reading && bundle && (reading->file == bundle)) {
+            printf("%s: still loading from the open bundle\n", path);
+            return false;
+        }
+
+        auto file = g_fileSystemInstance.get()->findFile(path);
+        BundleHeader header;
+
+        if (!file) {
+            printf("%s not found\n", path);
+            return false;
+        }
+        if ((file->read(&header, sizeof(header)) != sizeof(header)) || (header.magic != BUNDLE_MAGIC)) {
+            printf("%s is not an asset bundle\n", path);
+            delete file;
+            return false;
+        }
+
+        TEMPLATES::UniquePtr<BundleEntry[]> entries(new BundleEntry[header.numfiles]);
+        uint32_t tablesize = header.numfiles * sizeof(BundleEntry);
+        if (file->read(entries.get(), tablesize) != tablesize) {
+            printf("%s is truncated\n", path);
+            delete file;
+            return false;
+        }
+
+        if (bundle)
+            delete bundle;
+        bundle           = file;
+        bundleentries.reset(entries.release());
+        numbundleentries = header.numfiles;
+
+        // queued requests for assets the new bundle dropped have nothing to read
+        for (auto &request : requests) {
+            if ((request.state == ASSET_STATE_QUEUED) && !request.path[0] && !findBundleEntry(request.id)) {
+                printf("asset %08x is not in %s\n", request.id, path);
+                request.state = ASSET_STATE_FAILED;
+            }
+        }
+        return true;
+    }
+
+    const BundleEntry *AssetManager::findBundleEntry(uint32_t id) const {
+        uint32_t low = 0, high = numbundleentries;
+
+        while (low < high) {
+            uint32_t mid = (low + high) / 2;
+            if (bundleentries[mid].id < id)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+
+        return ((low < numbundleentries) && (bundleentries[low].id == id)) ? &bundleentries[low] : nullptr;
+    }
+
+    const Asset *AssetManager::_get(uint32_t id, Asset* (*create)(void)) {
+        auto entry = findEntry(id);
+        if (entry) {
+            entry->refcount++;
+            entry->lastuse = ++usecounter;
+            return entry->ptr;
+        }
+
+        auto bundled = findBundleEntry(id);
+        if (!bundled)
+            return nullptr;
+
+        // packed data goes at the end of the buffer and is unpacked over itself
+        uint32_t stored = bundled->packed ? bundled->packed : bundled->length;
+        uint32_t input  = bundled->packed ? LZDecoder::inPlaceOffset(bundled->length, bundled->packed, bundled->margin) : 0;
+        TEMPLATES::UniquePtr<uint32_t[]> data(new uint32_t[(input + stored + 3) / 4]);
+        auto bytes = reinterpret_cast<uint8_t *>(data.get());
+
+        bundle->seek(bundled->offset);
+        if (bundle->read(bytes + input, stored) != stored)
+            return nullptr;
+        if (bundled->packed && !LZDecoder::decompress(bytes, bundled->length, bytes + input, stored)) {
+            printf("asset %08x is corrupt\n", id);
+            return nullptr;
+        }
+
+        auto asset = create();
+        if (!asset)
+            return nullptr;
+        asset->id = id;
+
+        // same decoder as the async path, just without stopping
+        for (uint32_t position = 0; !asset->decode(bytes, bundled->length, position);) {}
+
+        if (!store(asset)) {
+            delete asset;
+            return nullptr;
+        }
+        return asset;
+    }
+
+    bool AssetManager::reload(uint32_t id, const char *path) {
+        auto entry = findEntry(id);
+        if (!entry)
+            return false;
+
+        // deleted or renamed away again before we got to it
+        auto file = g_fileSystemInstance.get()->findFile(path);
+        if (!file)
+            return false;
+        uint32_t length = uint32_t(file->getSize());
+        TEMPLATES::UniquePtr<uint32_t[]> data(new uint32_t[(length + 3) / 4]);
+        bool ok = file->read(data.get(), length) == length;
+        delete file;
+        if (!ok)
+            return false;
+
+        // loaded assets are only const to their users
+        auto asset = const_cast<Asset *>(entry->ptr);
+        for (int type = 0; type < ASSET_MEMORY_COUNT; type++)
+            stats[type].used -= asset->getMemory(AssetMemory(type));
+
+        auto bytes = reinterpret_cast<const uint8_t *>(data.get());
+        for (uint32_t position = 0; !asset->decode(bytes, length, position);) {}
+
+        for (int type = 0; type < ASSET_MEMORY_COUNT; type++) {
+            auto &stat = stats[type];
+            stat.used += asset->getMemory(AssetMemory(type));
+            if (stat.used > stat.peak)
+                stat.peak = stat.used;
+        }
+
+        trim();
+        return true;
+    }
+
+    void AssetManager::release(uint32_t id) {
+        auto entry = findEntry(id);
+        if (entry) {
+            // stays cached until the memory is needed
+            if (--entry->refcount <= 0) {
+                entry->refcount = 0;
+                entry->lastuse  = ++usecounter;
+                trim();
+            }
+            return;
+        }
+
+        auto request = findRequest(id);
+        if (!request || (--request->refcount > 0))
+            return;
+
+        // a read in flight still owns the buffer, onRead()/onChunk() clean up
+        if (request->state == ASSET_STATE_READING) {
+            request->cancelled = true;
+            return;
+        }
+
+        if (request->asset)
+            delete request->asset;
+        request->asset = nullptr;
+        request->data.reset();
+        request->state = ASSET_STATE_NONE;
+    }
+
+    //async loading
+    uint32_t AssetManager::_requestAsync(uint32_t id, const char *path, Asset* (*create)(void), uint8_t priority) {
+        if (path && (strlen(path) >= ENGINE::CONST::ASSET_PATH_MAX)) {
+            printf("%s: path too long to load in the background\n", path);
+            return 0;
+        }
+
+        auto entry = findEntry(id);
+        if (entry) {
+            entry->refcount++;
+            entry->lastuse = ++usecounter;
+            return id;
+        }
+
+        auto request = findRequest(id);
+        if (request) {
+            request->refcount++;
+            request->cancelled = false;
+            if (request->state == ASSET_STATE_FAILED)
+                request->state = ASSET_STATE_QUEUED; //give it another go
+            if (priority > request->priority)
+                request->priority = priority;
+            return id;
+        }
+
+        if (!path && !findBundleEntry(id))
+            return 0;
+
+        for (auto &slot : requests) {
+            if (slot.state != ASSET_STATE_NONE)
+                continue;
+
+            if (path)
+                strcpy(slot.path, path);
+            else
+                slot.path[0] = 0;
+            slot.id        = id;
+            slot.state     = ASSET_STATE_QUEUED;
+            slot.priority  = priority;
+            slot.cancelled = false;
+            slot.refcount  = 1;
+            slot.create    = create;
+            slot.asset     = nullptr;
+
+            if (!reading)
+                startReading();
+            return id;
+        }
+
+        return 0;
+    }
+
+    AssetState AssetManager::getState(uint32_t id) {
+        if (findEntry(id))
+            return ASSET_STATE_READY;
+
+        auto request = findRequest(id);
+        return request ? request->state : ASSET_STATE_NONE;
+    }
+
+    void AssetManager::startReading(void) {
+        AssetRequest *next = nullptr;
+        for (auto &request : requests)
+            if ((request.state == ASSET_STATE_QUEUED) && (!next || (request.priority > next->priority)))
+                next = &request;
+        if (!next)
+            return;
+
+        File *file;
+        next->packed = 0;
+        if (next->path[0]) {
+            file = g_fileSystemInstance.get()->findFile(next->path);
+            if (!file) {
+                printf("%s not found\n", next->path);
+                next->state = ASSET_STATE_FAILED;
+                startReading(); //on to the next one
+                return;
+            }
+            next->offset = 0;
+            next->length = uint32_t(file->getSize());
+        } else {
+            // the bundle may have been swapped since this was queued
+            auto bundled = findBundleEntry(next->id);
+            if (!bundled) {
+                printf("asset %08x is not in the bundle\n", next->id);
+                next->state = ASSET_STATE_FAILED;
+                startReading(); //on to the next one
+                return;
+            }
+            file         = bundle;
+            next->offset = bundled->offset;
+            next->length = bundled->length;
+            next->packed = bundled->packed;
+            next->input  = LZDecoder::inPlaceOffset(bundled->length, bundled->packed, bundled->margin);
+        }
+
+        if (next->packed) {
+            next->data.reset(new uint32_t[(next->input + next->packed + 3) / 4]);
+            auto bytes = reinterpret_cast<uint8_t *>(next->data.get());
+            next->lz.init(bytes, next->length, bytes + next->input, next->packed);
+            next->queued   = 0;
+            next->arrived  = 0;
+            next->early    = 0;
+            next->inflight = 0;
+            next->failed   = false;
+            next->file     = file;
+
+            queueChunks(next);
+            if (!next->inflight) {
+                next->data.reset();
+                return;
+            }
+
+            next->state = ASSET_STATE_READING;
+            reading     = next;
+            return;
+        }
+
+        next->data.reset(new uint32_t[(next->length + 3) / 4]);
+
+        // if the file system is out of slots, try again next frame
+        if (!file->readAsync(next->data.get(), next->length, next->offset, &onRead, next)) {
+            if (file != bundle)
+                delete file;
+            next->data.reset();
+            return;
+        }
+
+        next->file  = file;
+        next->state = ASSET_STATE_READING;
+        reading     = next;
+    }
+
+    void AssetManager::onRead(void *arg, void *buffer, uint32_t length) {
+        auto request = reinterpret_cast<AssetRequest *>(arg);
+        auto manager = g_assetManagerInstance.get();
+
+        if (request->file != manager->bundle)
+            delete request->file;
+        request->file = nullptr;
+        manager->reading = nullptr;
+
+        if (request->cancelled) {
+            request->data.reset();
+            request->state = ASSET_STATE_NONE;
+        } else if (length != request->length) {
+            manager->finishRequest(request, false);
+        } else {
+            manager->startDecoding(request);
+        }
+
+        // keep the drive busy, decoding happens in update()
+        manager->startReading();
+    }
+
+    void AssetManager::queueChunks(AssetRequest *request) {
+        auto input = reinterpret_cast<uint8_t *>(request->data.get()) + request->input;
+
+        while ((request->inflight < ENGINE::CONST::ASSET_CHUNKS_AHEAD) && (request->queued < request->packed)) {
+            uint32_t length = request->packed - request->queued;
+            if (length > CHUNK_SIZE)
+                length = CHUNK_SIZE;
+
+            // out of slots, update() tries again
+            if (!request->file->readAsync(input + request->queued, length, request->offset + request->queued, &onChunk, request))
+                return;
+            request->queued += length;
+            request->inflight++;
+        }
+    }
+
+    void AssetManager::onChunk(void *arg, void *buffer, uint32_t length) {
+        auto request = reinterpret_cast<AssetRequest *>(arg);
+        auto manager = g_assetManagerInstance.get();
+
+        auto input     = reinterpret_cast<uint8_t *>(request->data.get()) + request->input;
+        uint32_t start = reinterpret_cast<uint8_t *>(buffer) - input;
+        uint32_t left  = request->packed - start;
+        request->inflight--;
+
+        if (length != ((left < CHUNK_SIZE) ? left : CHUNK_SIZE))
+            request->failed = true;
+
+        // callbacks don't necessarily come in the order the reads were queued,
+        // this is kept up while released too so a request made again before
+        // the reads are back picks up where it was
+        if (!request->failed) {
+            request->early |= 1 << ((start - request->arrived) / CHUNK_SIZE);
+            while (request->early & 1) {
+                left = request->packed - request->arrived;
+                request->arrived += (left < CHUNK_SIZE) ? left : CHUNK_SIZE;
+                request->early  >>= 1;
+            }
+        }
+
+        // once released nothing more is queued or unpacked, only the reads
+        // already out are waited for
+        if (!request->failed && !request->cancelled) {
+            // the next chunk goes to the drive first, then everything that
+            // arrived is unpacked while it's being read
+            manager->queueChunks(request);
+            auto result = request->lz.decode(request->arrived);
+            if ((result == LZ_ERROR) || ((request->arrived == request->packed) && (result != LZ_DONE))) {
+                printf("asset %08x is corrupt\n", request->id);
+                request->failed = true;
+            }
+        }
+
+        // the reads still out own the buffer
+        if (request->inflight || (!request->failed && !request->cancelled && (request->arrived < request->packed)))
+            return;
+
+        request->file    = nullptr;
+        manager->reading = nullptr;
+
+        if (request->cancelled) {
+            request->data.reset();
+            request->state = ASSET_STATE_NONE;
+        } else if (request->failed) {
+            manager->finishRequest(request, false);
+        } else {
+            manager->startDecoding(request);
+        }
+
+        manager->startReading();
+    }
+
+    void AssetManager::startDecoding(AssetRequest *request) {
+        request->asset = request->create();
+        if (!request->asset) {
+            printf("asset %08x could not be created\n", request->id);
+            finishRequest(request, false);
+            return;
+        }
+
+        request->asset->id = request->id;
+        request->position  = 0;
+        request->state     = ASSET_STATE_DECODING;
+    }
+
+    void AssetManager::finishRequest(AssetRequest *request, bool ok) {
+        request->data.reset();
+
+        if (ok && store(request->asset)) {
+            findEntry(request->id)->refcount = request->refcount;
+            request->asset = nullptr;
+            request->state = ASSET_STATE_NONE;
+            return;
+        }
+
+        if (request->asset)
+            delete request->asset;
+        request->asset = nullptr;
+        request->state = ASSET_STATE_FAILED;
+    }
+
+    void AssetManager::update(void) {
+        if (!reading) {
+            startReading();
+        } else if (reading->packed && !reading->inflight) {
+            // ran out of file system slots last time
+            if (!reading->cancelled) {
+                queueChunks(reading);
+            } else {
+                reading->file = nullptr;
+                reading->data.reset();
+                reading->state = ASSET_STATE_NONE;
+                reading = nullptr;
+                startReading();
+            }
+        }
+
+        // most important first, until the budget is used up
+        auto timer = g_timerInstance.get();
+        uint64_t start = timer->getTicks();
+
+        do {
+            AssetRequest *next = nullptr;
+            for (auto &request : requests)
+                if ((request.state == ASSET_STATE_DECODING) && (!next || (request.priority > next->priority)))
+                    next = &request;
+            if (!next)
+                return;
+
+            auto data = reinterpret_cast<const uint8_t *>(next->data.get());
+            if (next->asset->decode(data, next->length, next->position))
+                finishRequest(next, true);
+        } while (timer->ticksToUS(timer->getTicks() - start) < ENGINE::CONST::ASSET_DECODE_BUDGET_US);
+    }
+
 
     const Asset *TestAsset::loadFromFile(const char *path) {
         auto asset = new TestAsset();
@@ -20,7 +618,13 @@ namespace ENGINE {
         asset->testvar = 1;
         return asset;
     }
+
+    bool TestAsset::decode(const uint8_t *data, uint32_t length, uint32_t &position) {
+        testvar  = 1;
+        position = length;
+        return true;
+    }
     
     TestAsset::~TestAsset(void) {}
 
-} //namespace ENGINE
\ No newline at end of file
+} //namespace ENGINE
@@ -2,38 +2,68 @@
 
 #include "constants.hpp"
 #include "templates.hpp"
+#include "cddrive.hpp"
+#include "hash.hpp"
+#include "lz.hpp"
 
 #include <stdint.h>
 
 namespace ENGINE {
 
+    enum AssetMemory : uint8_t {
+        ASSET_MEMORY_RAM,
+        ASSET_MEMORY_VRAM,
+        ASSET_MEMORY_SPU,
+        ASSET_MEMORY_COUNT
+    };
+
     class Asset {
     public:
         const uint32_t getID(void) const {return id;}
+        uint32_t getMemory(AssetMemory type) const {return memory[type];}
         
-        Asset(void) {id = 0;}
+        Asset(void) : memory{} {id = 0;}
         virtual ~Asset() = default;
 
         static const Asset* loadFromFile(const char *path) { (void)path; return nullptr; }
+
+        // for AssetManager::requestAsync(), types that can be loaded in the
+        // background return a blank asset here and fill it in decode()
+        static Asset* create(void) { return nullptr; }
+        // gets the whole file once it's been read and is called again every
+        // frame (as long as there's time left) until it returns true. position
+        // is where the last call left off, 0 the first time. on pc it can be
+        // called again on a loaded asset when its file changes (hot reload),
+        // so it has to drop whatever it held first
+        virtual bool decode(const uint8_t *data, uint32_t length, uint32_t &position) {
+            (void)data;
+            position = length;
+            return true;
+        }
     protected:
         uint32_t id;
+        uint32_t memory[ASSET_MEMORY_COUNT]; // bytes held in each, set by the loader
+        friend class AssetManager;
     };
 
     class TestAsset : public Asset {
     public:
         uint8_t testvar;
-        TestAsset() = default;
+        TestAsset() {memory[ASSET_MEMORY_RAM] = sizeof(TestAsset);}
         ~TestAsset();
 
         static const Asset* loadFromFile(const char *path);
+        static Asset* create(void) { return new TestAsset(); }
+        bool decode(const uint8_t *data, uint32_t length, uint32_t &position);
     };
 
     class AssetEntry {
     public:
-        int refcount;
+        int refcount; // 0 means cached, free to evict
         const Asset* ptr;
+        uint32_t lastuse;
 
-        AssetEntry() : refcount(1), ptr(nullptr) {}
+        AssetEntry() : refcount(1), ptr(nullptr), lastuse(0) {}
         ~AssetEntry() {
             if (ptr) 
                 delete ptr;
@@ -41,31 +71,178 @@ namespace ENGINE {
         }
     };
 
+    enum AssetState : uint8_t {
+        ASSET_STATE_NONE,     // never requested (or released)
+        ASSET_STATE_QUEUED,   // waiting for the drive
+        ASSET_STATE_READING,
+        ASSET_STATE_DECODING,
+        ASSET_STATE_READY,
+        ASSET_STATE_FAILED    // stays until released
+    };
+
+    class File;
+
+    // a requestAsync() making its way through the drive and the decoder
+    struct AssetRequest {
+        uint32_t id;
+        AssetState state;
+        uint8_t priority; // a CDPriority
+        bool cancelled;   // released while the file was still being read
+        int refcount;
+        char path[CONST::ASSET_PATH_MAX];
+        Asset* (*create)(void);
+
+        File *file;
+        uint64_t offset; // of the asset within file
+        TEMPLATES::UniquePtr<uint32_t[]> data; // word aligned for the dma
+        uint32_t length, position;
+        Asset *asset;
+
+        // packed bundle entries are read in chunks to the end of data and
+        // unpacked to its start as they come in, while the drive carries on
+        LZDecoder lz;
+        uint32_t packed;  // 0 if the asset is stored as is
+        uint32_t input;   // where in data the packed bytes go
+        uint32_t queued;  // packed bytes asked for
+        uint32_t arrived; // packed bytes in, without gaps
+        uint8_t early;    // chunks in past arrived, bit 0 is the one at arrived
+        uint8_t inflight;
+        bool failed;
+
+        AssetRequest(void) : id(0), state(ASSET_STATE_NONE), priority(0), cancelled(false), refcount(0), create(nullptr), file(nullptr), offset(0), length(0), position(0), asset(nullptr), packed(0), input(0), queued(0), arrived(0), early(0), inflight(0), failed(false) {}
+    };
+
+    // assets.xbnl as written by tools/makeBundle.py, the table is sorted by
+    // id and every file starts on a sector boundary
+    struct BundleHeader {
+        uint32_t magic; // "XBNL"
+        uint32_t numfiles;
+    };
+
+    struct BundleEntry {
+        uint32_t id; // hash of "assets/<path>", see assetmanifest.hpp
+        uint32_t offset;
+        uint32_t length; // unpacked
+        uint32_t packed; // lz4 block (see lz.hpp) of this many bytes, 0 if stored as is
+        uint32_t margin; // extra room needed to unpack it in place
+    };
+
+    struct AssetMemoryStats {
+        uint32_t used, peak, budget;
+        uint32_t evictions; // assets dropped to stay within the budget
+    };
+
+    // released assets aren't freed right away but kept around in case
+    // they're needed again (the car between two stages...) until one of the
+    // memory budgets runs out, then the least recently used go first
     class AssetManager {
     public:
         static AssetManager &instance();
 
+        // loads in the background, get(id) returns the asset once getState()
+        // says it's ready. counts as a reference just like get(path). the
+        // most important request is read first and decoding is spread over
+        // frames, ASSET_DECODE_BUDGET_US per update() at most. returns 0 when
+        // all ASSET_MAX_REQUESTS slots are taken
+        template<typename T>
+        uint32_t requestAsync(const char *path, uint8_t priority = CD_PRIORITY_NORMAL) {
+            static_assert(canCreate<T>(), "T has to override Asset::create() to be loaded in the background");
+            return _requestAsync(ENGINE::HASH::FromString(path), path, &(T::create), priority);
+        }
+        // same for an asset in the bundle, eg. requestAsync<Model>(ASSETS::CARS_CAR_XMDL)
+        template<typename T>
+        uint32_t requestAsync(uint32_t id, uint8_t priority = CD_PRIORITY_NORMAL) {
+            static_assert(canCreate<T>(), "T has to override Asset::create() to be loaded in the background");
+            return _requestAsync(id, nullptr, &(T::create), priority);
+        }
+        AssetState getState(uint32_t id);
+        // call once per frame, after FileSystem::update()
+        void update(void);
+
         // Allow loading new assets: assetManager.get<ImageAsset>(path)
         template<typename T>
         const T* get(const char *path) {
             return reinterpret_cast<const T*>(_get(path, &(T::loadFromFile)));
         }
 
+        // Load from the bundle by id: assetManager.get<ImageAsset>(ASSETS::FONT_XTEX)
+        // no strings involved, the id is a constant from src/assetmanifest.hpp
+        // (written by makeassets.py, which the build scripts run first)
+        template<typename T>
+        const T* get(uint32_t id) {
+            static_assert(canCreate<T>(), "T has to override Asset::create() to be loaded from the bundle");
+            return reinterpret_cast<const T*>(_get(id, &(T::create)));
+        }
+
         // Only retrieve already loaded assets: assetManager.get(asset->id)
         const Asset* get(uint32_t id) {
             return _get(id);
         }
 
         void release(uint32_t id);
+
+        void setBudget(AssetMemory type, uint32_t bytes);
+        const AssetMemoryStats &getStats(AssetMemory type) const {return stats[type];}
+        // restarts peak and eviction counts, call when switching scenes
+        void resetStats(void);
+        // frees every cached asset nobody holds
+        void purge(void);
+
+        // makes the assets packed by makeassets.py available by id. false
+        // (and the old one kept) while a background load reads from it
+        bool openBundle(const char *path);
+
+        // rereads path into the loaded asset with the given id, in place, so
+        // pointers and ids handed out stay valid. false if it isn't loaded
+        // or the file can't be read, the asset is left as it was then
+        bool reload(uint32_t id, const char *path);
+        // same for an asset loaded by path
+        bool reload(const char *path) {return reload(ENGINE::HASH::FromString(path), path);}
     private:
         AssetEntry loadedassets[ENGINE::CONST::ASSET_MAX];
+        AssetMemoryStats stats[ASSET_MEMORY_COUNT];
+        uint32_t usecounter;
+        AssetRequest requests[ENGINE::CONST::ASSET_MAX_REQUESTS];
+        AssetRequest *reading; // only one file is read at a time, there's one drive
+
+        File *bundle;
+        TEMPLATES::UniquePtr<BundleEntry[]> bundleentries;
+        uint32_t numbundleentries;
+
+        AssetManager(void);
+
+        // the base create() only ever returns nullptr
+        template<typename T>
+        static constexpr bool canCreate(void) {return &T::create != &Asset::create;}
 
         const Asset* _get(const char *path, const Asset* (*loader)(const char *));
         const Asset* _get(uint32_t id) {
-            for (int i = 0; i < ENGINE::CONST::ASSET_MAX; i++)
-                if (id == loadedassets[i].ptr->getID())
+            for (int i = 0; i < ENGINE::CONST::ASSET_MAX; i++) {
+                if (loadedassets[i].ptr && (id == loadedassets[i].ptr->getID())) {
+                    loadedassets[i].lastuse = ++usecounter;
                     return loadedassets[i].ptr;
+                }
+            }
+            return nullptr;
         };
+        const Asset* _get(uint32_t id, Asset* (*create)(void));
+        // path is nullptr for bundled assets
+        uint32_t _requestAsync(uint32_t id, const char *path, Asset* (*create)(void), uint8_t priority);
+        const BundleEntry *findBundleEntry(uint32_t id) const;
+        AssetEntry *findEntry(uint32_t id);
+        AssetRequest *findRequest(uint32_t id);
+        bool store(const Asset *asset);
+        void unload(AssetEntry *entry);
+        // evicts until every budget fits, false if held assets alone are over
+        bool trim(void);
+        void startReading(void);
+        // keeps up to ASSET_CHUNKS_AHEAD reads of a packed asset queued
+        void queueChunks(AssetRequest *request);
+        // once the whole file is in, fails the request if create() doesn't give an asset
+        void startDecoding(AssetRequest *request);
+        void finishRequest(AssetRequest *request, bool ok);
+        static void onRead(void *arg, void *buffer, uint32_t length);
+        static void onChunk(void *arg, void *buffer, uint32_t length);
     };
 
     extern ENGINE::TEMPLATES::ServiceLocator<AssetManager> g_assetManagerInstance;
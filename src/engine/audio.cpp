@@ -1,15 +1,141 @@
 #include "audio.hpp"
+#include <stdio.h> //printf
 
 namespace ENGINE {
 
     TEMPLATES::ServiceLocator<Audio> g_audioInstance;
 
+    static constexpr uint32_t SOUND_FILE_MAGIC = 'X' | ('S' << 8) | ('N' << 16) | ('D' << 24);
+
     Audio &Audio::instance() {
         static Audio *instance;
         #ifdef PLATFORM_PSX
-    //    instance = new PSX::PSXAudio();
+        instance = new PSX::PSXAudio();
+        #else
+        instance = new GENERIC::SDLAudio();
         #endif
         return *instance;
     }
 
+    Audio::Audio(void) {
+        playcounter = 0;
+        for (auto &v : voices) {
+            v.sound = nullptr;
+            v.age = 0;
+            v.priority = 0;
+            v.generation = 0;
+            v.active = false;
+        }
+    }
+
+    Sound *Audio::loadSoundFile(const void *data) {
+        auto header = reinterpret_cast<const SoundFileHeader *>(data);
+        if (header->magic != SOUND_FILE_MAGIC) {
+            printf("not a sound file\n");
+            return nullptr;
+        }
+
+        // the loop itself is in the adpcm flags, the header has to agree
+        auto sound = loadSound(&header[1], header->length, header->samplerate);
+        if (sound && (sound->loop != (header->loopstart != SOUND_NO_LOOP))) {
+            printf("sound file loop point doesn't match its data\n");
+            freeSound(sound);
+            return nullptr;
+        }
+        return sound;
+    }
+
+    VoiceHandle Audio::play(const Sound *sound, uint8_t priority, int16_t left, int16_t right, uint16_t pitch) {
+        if (!sound)
+            return INVALID_VOICE;
+
+        int ch = allocateChannel(priority);
+        if (ch < 0)
+            return INVALID_VOICE;
+
+        auto &v = voices[ch];
+        v.sound = sound;
+        v.age = playcounter++;
+        v.priority = priority;
+        v.generation++;
+        v.active = true;
+
+        startVoice(ch, sound, left, right, scalePitch(sound, pitch));
+        return (VoiceHandle(v.generation) << 8) | ch;
+    }
+
+    void Audio::stop(VoiceHandle voice) {
+        int ch = getChannel(voice);
+        if (ch < 0)
+            return;
+
+        voices[ch].active = false;
+        stopVoice(ch);
+    }
+
+    void Audio::setVolume(VoiceHandle voice, int16_t left, int16_t right) {
+        int ch = getChannel(voice);
+        if (ch >= 0)
+            setVoiceVolume(ch, left, right);
+    }
+
+    void Audio::setPitch(VoiceHandle voice, uint16_t pitch) {
+        int ch = getChannel(voice);
+        if (ch >= 0)
+            setVoicePitch(ch, scalePitch(voices[ch].sound, pitch));
+    }
+
+    bool Audio::isPlaying(VoiceHandle voice) {
+        return getChannel(voice) >= 0;
+    }
+
+    int Audio::getChannel(VoiceHandle voice) {
+        if (voice < 0)
+            return -1;
+
+        int ch = voice & 0xff;
+        if ((ch >= CONST::AUDIO_NUM_VOICES) || !voices[ch].active || (voices[ch].generation != uint8_t(voice >> 8)))
+            return -1;
+
+        return ch;
+    }
+
+    int Audio::allocateChannel(uint8_t priority) {
+        int victim = -1;
+
+        for (int ch = 0; ch < CONST::AUDIO_NUM_VOICES; ch++) {
+            auto &v = voices[ch];
+            if (!v.active)
+                return ch;
+
+            // steal the least important voice, the oldest one out of those
+            if (v.priority > priority)
+                continue;
+            if (
+                (victim < 0) ||
+                (v.priority < voices[victim].priority) ||
+                ((v.priority == voices[victim].priority) && ((playcounter - v.age) > (playcounter - voices[victim].age)))
+            )
+                victim = ch;
+        }
+
+        return victim;
+    }
+
+    void Audio::releaseChannels(uint32_t endedmask) {
+        for (int ch = 0; endedmask && (ch < CONST::AUDIO_NUM_VOICES); ch++, endedmask >>= 1) {
+            if ((endedmask & 1) && voices[ch].active && !voices[ch].sound->loop)
+                voices[ch].active = false;
+        }
+    }
+
+    void Audio::stopSound(const Sound *sound) {
+        for (int ch = 0; ch < CONST::AUDIO_NUM_VOICES; ch++) {
+            if (voices[ch].active && (voices[ch].sound == sound)) {
+                voices[ch].active = false;
+                stopVoice(ch);
+            }
+        }
+    }
+
 } //namespace ENGINE
\ No newline at end of file
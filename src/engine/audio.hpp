@@ -1,14 +1,101 @@
-#pragma once 
+#pragma once
 
 #include "templates.hpp"
+#include "constants.hpp"
+#include <stdint.h>
+
+#ifndef PLATFORM_PSX
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <vector>
+#endif
 
 namespace ENGINE {
 
+    // a sample uploaded to the sound hardware, created by Audio::loadSound
+    class Sound {
+    public:
+        uint32_t length;     // size of the adpcm data in bytes
+        uint32_t samplerate;
+        uint16_t basepitch;  // spu pitch (4.12, 0x1000 = 44100hz) for samplerate
+        bool loop;           // data ends in a loop block, voice never stops on its own
+
+        virtual ~Sound() = default;
+    };
+
+    // .xsnd file written by tools/convertAudio.py, the adpcm data follows
+    // right after and stays 16 byte aligned, so it can be uploaded directly
+    struct SoundFileHeader {
+        uint32_t magic; // "XSND"
+        uint32_t length;
+        uint32_t samplerate;
+        uint32_t loopstart; // in samples, SOUND_NO_LOOP for one-shots
+    };
+    constexpr uint32_t SOUND_NO_LOOP = 0xffffffff;
+
+    // (generation << 8) | channel, a handle to a voice that got stolen or
+    // finished since is simply ignored
+    using VoiceHandle = int32_t;
+    constexpr VoiceHandle INVALID_VOICE = -1;
+
     class Audio {
     public:
+        // data is spu adpcm (16 byte blocks with the loop flags already set),
+        // must be 4 byte aligned
+        virtual Sound *loadSound(const void *data, uint32_t length, uint32_t samplerate) { return nullptr; }
+        virtual void freeSound(Sound *sound) {}
+        // same as loadSound() for the contents of an .xsnd file
+        Sound *loadSoundFile(const void *data);
+
+        // plays sound on a free voice, or steals the oldest voice with the
+        // lowest priority <= priority. pitch is 4.12 relative to the sample
+        // rate. returns INVALID_VOICE if everything playing is more important
+        VoiceHandle play(const Sound *sound, uint8_t priority, int16_t left = CONST::AUDIO_MAX_VOLUME, int16_t right = CONST::AUDIO_MAX_VOLUME, uint16_t pitch = CONST::GTE_ONE);
+        void stop(VoiceHandle voice);
+        void setVolume(VoiceHandle voice, int16_t left, int16_t right);
+        void setPitch(VoiceHandle voice, uint16_t pitch);
+        bool isPlaying(VoiceHandle voice);
+
+        // call once per frame, commits everything started/stopped this frame
+        virtual void update(void) {}
+
         static Audio &instance();
     protected:
-        Audio() {}
+        struct Voice {
+            const Sound *sound;
+            uint32_t age;       // value of playcounter when started
+            uint8_t  priority;
+            uint8_t  generation;
+            bool     active;
+        };
+
+        Voice voices[CONST::AUDIO_NUM_VOICES];
+        uint32_t playcounter;
+
+        Audio();
+        virtual ~Audio() = default;
+
+        int getChannel(VoiceHandle voice);
+        int allocateChannel(uint8_t priority);
+        // frees channels whose one-shot sound has reached its end
+        void releaseChannels(uint32_t endedmask);
+        // stops every voice still playing sound (before freeing it)
+        void stopSound(const Sound *sound);
+
+        static uint16_t scalePitch(const Sound *sound, uint16_t pitch) {
+            uint32_t scaled = (uint32_t(sound->basepitch) * pitch) >> 12;
+            return uint16_t((scaled > CONST::AUDIO_MAX_PITCH) ? CONST::AUDIO_MAX_PITCH : scaled);
+        }
+        static uint16_t basePitch(uint32_t samplerate) {
+            uint32_t pitch = (samplerate << 12) / 44100;
+            return uint16_t((pitch > CONST::AUDIO_MAX_PITCH) ? CONST::AUDIO_MAX_PITCH : pitch);
+        }
+
+        // hardware side, channel is always valid here
+        virtual void startVoice(int ch, const Sound *sound, int16_t left, int16_t right, uint16_t pitch) {}
+        virtual void stopVoice(int ch) {}
+        virtual void setVoiceVolume(int ch, int16_t left, int16_t right) {}
+        virtual void setVoicePitch(int ch, uint16_t pitch) {}
     };
 
     extern TEMPLATES::ServiceLocator<Audio> g_audioInstance;
@@ -16,15 +103,173 @@ namespace ENGINE {
     //psx
 #ifdef PLATFORM_PSX
     namespace PSX {
+        class PSXSound : public Sound {
+        public:
+            uint32_t addr; // in spu ram
+        };
+
+        // first fit allocator for spu ram, blocks are kept sorted by address
+        // and merged back together when freed
+        class SPUAllocator {
+        public:
+            void init(uint32_t start, uint32_t end);
+            uint32_t alloc(uint32_t size); // 0 if out of memory
+            void free(uint32_t addr);
+            uint32_t getFree(void) const;
+        private:
+            struct Block {
+                uint32_t addr, size;
+                bool used;
+            };
+            Block blocks[CONST::AUDIO_SPU_MAX_BLOCKS];
+            int numblocks;
+        };
+
         class PSXAudio : public Audio {
         public:
-            PSXAudio(void);	
+            PSXAudio(void);
+
+            Sound *loadSound(const void *data, uint32_t length, uint32_t samplerate);
+            void freeSound(Sound *sound);
+            void update(void);
+
+            uint32_t getFreeRAM(void) const {return allocator.getFree();}
         private:
+            SPUAllocator allocator;
+            // key on/off requests are collected here and written to the spu
+            // all at once in update()
+            uint32_t keyonmask, keyoffmask;
+
+            void upload(uint32_t addr, const void *data, uint32_t length);
+            void uploadChunks(uint32_t addr, const void *data, uint32_t numchunks);
+
+            void startVoice(int ch, const Sound *sound, int16_t left, int16_t right, uint16_t pitch);
+            void stopVoice(int ch);
+            void setVoiceVolume(int ch, int16_t left, int16_t right);
+            void setVoicePitch(int ch, uint16_t pitch);
         };
     } //namespace PSX
 #else
     namespace GENERIC {
-        
+        class SDLSound : public Sound {
+        public:
+            // adpcm decoded to pcm at load time, plus one guard sample after
+            // the end so interpolation never has to check bounds
+            TEMPLATES::UniquePtr<float[]> samples;
+            uint32_t numsamples;
+            uint32_t loopstart;
+        };
+
+        // lock free single producer/single consumer queue, push() must only
+        // be called from one thread and pop() from one other thread
+        template<typename T, uint32_t N>
+        class SPSCRing {
+            static_assert(!(N & (N - 1)), "ring size must be a power of 2");
+        public:
+            bool push(const T &item) {
+                uint32_t head = _head.load(std::memory_order_relaxed);
+                if ((head - _tail.load(std::memory_order_acquire)) >= N)
+                    return false;
+
+                items[head & (N - 1)] = item;
+                _head.store(head + 1, std::memory_order_release);
+                return true;
+            }
+
+            bool pop(T &item) {
+                uint32_t tail = _tail.load(std::memory_order_relaxed);
+                if (tail == _head.load(std::memory_order_acquire))
+                    return false;
+
+                item = items[tail & (N - 1)];
+                _tail.store(tail + 1, std::memory_order_release);
+                return true;
+            }
+
+            // running totals, usable as sequence numbers
+            uint32_t getPushed(void) const {return _head.load(std::memory_order_relaxed);}
+            uint32_t getPopped(void) const {return _tail.load(std::memory_order_acquire);}
+
+        private:
+            T items[N];
+            alignas(64) std::atomic<uint32_t> _head{0};
+            alignas(64) std::atomic<uint32_t> _tail{0};
+        };
+
+        // the game thread only ever talks to the sdl callback through the
+        // command ring and the finished handles, so the callback never takes
+        // a lock, allocates or waits on the game thread
+        class SDLAudio : public Audio {
+        public:
+            SDLAudio(void);
+            ~SDLAudio(void);
+
+            Sound *loadSound(const void *data, uint32_t length, uint32_t samplerate);
+            void freeSound(Sound *sound);
+            void update(void);
+
+            // commands that found the ring full and had to wait for update()
+            uint32_t getDeferredCommands(void) const {return deferredcommands;}
+        private:
+            enum CommandType : uint8_t {
+                CMD_START,
+                CMD_STOP,
+                CMD_VOLUME,
+                CMD_PITCH
+            };
+
+            struct Command {
+                CommandType type;
+                uint8_t ch;
+                uint16_t pitch;
+                int16_t left, right;
+                int32_t handle;
+                const SDLSound *sound;
+            };
+
+            // owned by the callback
+            struct MixVoice {
+                const SDLSound *sound;
+                uint64_t pos, step; //32.32 in source samples
+                float left, right;
+                int32_t handle;
+                bool active;
+            };
+
+            // sounds can only be deleted once the callback has seen the stop
+            // commands for them, ie. once it has popped up to seq (counting
+            // the ones still in the backlog)
+            struct PendingFree {
+                SDLSound *sound;
+                uint32_t seq;
+            };
+
+            SDL_AudioDeviceID device;
+            uint32_t outputrate;
+            uint32_t deferredcommands;
+
+            SPSCRing<Command, CONST::AUDIO_COMMAND_RING> commands;
+            std::vector<Command> backlog; //waiting for room in the ring, in order
+            std::atomic<int32_t> finished[CONST::AUDIO_NUM_VOICES];
+            std::vector<PendingFree> pendingfrees;
+
+            MixVoice mixvoices[CONST::AUDIO_NUM_VOICES];
+            uint32_t mixframes;
+            TEMPLATES::UniquePtr<float[]> mixleft, mixright, resampled;
+
+            void send(const Command &cmd);
+            void flushBacklog(void);
+            uint64_t pitchToStep(uint16_t pitch) const;
+
+            static void callback(void *userdata, uint8_t *stream, int length);
+            void mix(int16_t *output, uint32_t frames);
+            uint32_t mixVoice(int ch, uint32_t frames);
+
+            void startVoice(int ch, const Sound *sound, int16_t left, int16_t right, uint16_t pitch);
+            void stopVoice(int ch);
+            void setVoiceVolume(int ch, int16_t left, int16_t right);
+            void setVoicePitch(int ch, uint16_t pitch);
+        };
     } //namespace GENERIC
 #endif
 } //namespace ENGINE
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include "cddrive.hpp"
+#include "common.hpp"
+#include <assert.h>
+
+namespace ENGINE {
+
+    void CDScheduler::submit(CDRequest *request) {
+        assert(request->numSectors && request->output);
+        assert(COMMON::isBufferAligned(request->output));
+
+        request->state  = CD_REQUEST_PENDING;
+        request->waited = 0;
+        request->next   = pending;
+        pending = request;
+    }
+
+    bool CDScheduler::cancel(CDRequest *request) {
+        if (request->state != CD_REQUEST_PENDING)
+            return false;
+
+        unlink(request);
+        request->state = CD_REQUEST_IDLE;
+        return true;
+    }
+
+    void CDScheduler::unlink(CDRequest *request) {
+        for (auto link = &pending; *link; link = &(*link)->next) {
+            if (*link == request) {
+                *link = request->next;
+                request->next = nullptr;
+                return;
+            }
+        }
+    }
+
+    uint32_t CDScheduler::getPriority(const CDRequest *request) {
+        if (request->priority >= CD_PRIORITY_STREAM)
+            return request->priority;
+
+        // aging stops just short of the stream class, a request that waited
+        // long enough beats any other non stream one but never the audio
+        uint32_t priority = request->priority + (request->waited / CONST::CD_AGING_SERVICES) * CONST::CD_AGING_STEP;
+        return (priority >= CD_PRIORITY_STREAM) ? (CD_PRIORITY_STREAM - 1) : priority;
+    }
+
+    CDRequest *CDScheduler::pickNext(void) {
+        uint32_t best = 0;
+        for (auto req = pending; req; req = req->next)
+            if (getPriority(req) > best)
+                best = getPriority(req);
+
+        // scan within the most important class: the closest request ahead of
+        // the head in the current direction, turning around when there's none
+        uint32_t head = drive->getHeadLBA();
+        for (int pass = 0; pass < 2; pass++) {
+            CDRequest *pick = nullptr;
+
+            for (auto req = pending; req; req = req->next) {
+                if (getPriority(req) != best)
+                    continue;
+                if (ascending ? (req->lba < head) : (req->lba > head))
+                    continue;
+                if (!pick || (ascending ? (req->lba < pick->lba) : (req->lba > pick->lba)))
+                    pick = req;
+            }
+
+            if (pick)
+                return pick;
+            ascending = !ascending;
+        }
+
+        return nullptr; //unreachable as long as something is pending
+    }
+
+    void CDScheduler::buildRun(void) {
+        auto first = pickNext();
+        assert(first);
+
+        // grow the run with anything overlapping it or close enough on either
+        // side that reading the gap beats a seek. lower priority requests
+        // ride along for free
+        uint32_t start = first->lba;
+        uint32_t end   = first->lba + first->numSectors;
+
+        numrun = 0;
+        run[numrun++] = first;
+        unlink(first);
+
+        for (bool grown = true; grown && (numrun < CONST::CD_MAX_RUN_REQUESTS);) {
+            grown = false;
+
+            for (auto req = pending; req; req = req->next) {
+                uint32_t reqend = req->lba + req->numSectors;
+                if ((req->lba > end + CONST::CD_MERGE_GAP) || (reqend + CONST::CD_MERGE_GAP < start))
+                    continue;
+
+                uint32_t newstart = (req->lba < start) ? req->lba : start;
+                uint32_t newend   = (reqend > end) ? reqend : end;
+                if (((newend - newstart) > (end - start)) && ((newend - newstart) > CONST::CD_MAX_RUN_SECTORS))
+                    continue; //would make the run too long
+
+                start = newstart;
+                end   = newend;
+                run[numrun++] = req;
+                unlink(req);
+                grown = true;
+                break;
+            }
+        }
+
+        uint32_t count = end - start;
+        if (count > ptrcapacity) {
+            ptrs.reset(new void *[count]);
+            owners.reset(new uint8_t[count]);
+            ptrcapacity = count;
+        }
+
+        // every sector goes straight into the first request covering it,
+        // sectors nobody asked for go to the scratch buffer
+        for (uint32_t i = 0; i < count; i++) {
+            ptrs[i]   = scratch;
+            owners[i] = 0xff;
+        }
+        for (int r = numrun - 1; r >= 0; r--) {
+            auto req = run[r];
+            for (uint32_t i = 0; i < req->numSectors; i++) {
+                ptrs[req->lba - start + i]   = reinterpret_cast<uint8_t *>(req->output) + (i * CONST::SECTOR_SIZE);
+                owners[req->lba - start + i] = uint8_t(r);
+            }
+        }
+
+        uint32_t head = drive->getHeadLBA();
+        stats.seekdistance += (start > head) ? (start - head) : (head - start);
+        stats.runs++;
+        for (uint32_t i = 0; i < count; i++)
+            if (owners[i] == 0xff)
+                stats.gapsectors++;
+
+        runstart = start;
+        runcount = count;
+    }
+
+    void CDScheduler::finishRun(bool ok) {
+        // overlapping requests get a copy of the sectors someone else owned
+        for (int r = 0; r < numrun; r++) {
+            auto req = run[r];
+
+            if (ok) {
+                for (uint32_t i = 0; i < req->numSectors; i++) {
+                    uint32_t sector = req->lba - runstart + i;
+                    if (owners[sector] != r)
+                        __builtin_memcpy(
+                            reinterpret_cast<uint8_t *>(req->output) + (i * CONST::SECTOR_SIZE),
+                            ptrs[sector],
+                            CONST::SECTOR_SIZE
+                        );
+                }
+            }
+
+            req->state = ok ? CD_REQUEST_DONE : CD_REQUEST_FAILED;
+        }
+
+        stats.requests += numrun;
+        if (numrun > 1)
+            stats.merged += numrun;
+        numrun = 0;
+
+        for (auto req = pending; req; req = req->next)
+            req->waited++;
+    }
+
+    bool CDScheduler::service(void) {
+        // a run update() started has to land first, pollAsync() times out on its own
+        if (numrun) {
+            CDAsyncState state;
+            while ((state = drive->pollAsync()) == CD_ASYNC_BUSY) {}
+            finishRun(state == CD_ASYNC_DONE);
+        }
+        if (!pending)
+            return false;
+
+        buildRun();
+        finishRun(drive->readSectors(runstart, ptrs.get(), int(runcount)));
+        return true;
+    }
+
+    bool CDScheduler::update(void) {
+        if (numrun) {
+            auto state = drive->pollAsync();
+            if (state == CD_ASYNC_BUSY)
+                return true;
+            finishRun(state == CD_ASYNC_DONE);
+        }
+        if (!pending)
+            return false;
+
+        buildRun();
+        if (!drive->readSectorsAsync(runstart, ptrs.get(), int(runcount)))
+            finishRun(false);
+        return true;
+    }
+
+} //namespace ENGINE
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "templates.hpp"
+#include "constants.hpp"
+#include <stdint.h>
+
+#ifndef PLATFORM_PSX
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace ENGINE {
+
+    enum CDAsyncState : uint8_t {
+        CD_ASYNC_IDLE,
+        CD_ASYNC_BUSY,
+        CD_ASYNC_DONE,
+        CD_ASYNC_FAILED
+    };
+
+    // the part of a cd drive everything above the hardware needs, so the
+    // scheduler and filesystem code can run against a simulated drive too
+    class CDDrive {
+    public:
+        // blocking read of numSectors 2048 byte sectors into ptr (4 byte aligned)
+        virtual bool read(uint32_t lba, void *ptr, int numSectors) = 0;
+        // same, but sector n goes to ptrs[n]
+        virtual bool readSectors(uint32_t lba, void *const *ptrs, int numSectors) = 0;
+        // where the head is (roughly), the next sector a read would get without seeking
+        virtual uint32_t getHeadLBA(void) const = 0;
+        // starts a read and returns right away, only one can be in flight.
+        // blocking reads issued meanwhile wait for it to finish first
+        virtual bool readAsync(uint32_t lba, void *ptr, int numSectors) = 0;
+        // readAsync, but sector n goes to ptrs[n] (which must stay valid until done)
+        virtual bool readSectorsAsync(uint32_t lba, void *const *ptrs, int numSectors) = 0;
+        // state of the last readAsync, done/failed stick until the next one
+        virtual CDAsyncState pollAsync(void) = 0;
+        virtual ~CDDrive() = default;
+    };
+
+    enum CDPriority : uint8_t {
+        CD_PRIORITY_BACKGROUND = 0,   // prefetching, whenever there's time
+        CD_PRIORITY_NORMAL     = 64,  // regular asset loads
+        CD_PRIORITY_URGENT     = 128, // something is waiting on it right now
+        CD_PRIORITY_STREAM     = 192  // audio/streams, always served first, nothing ages into this
+    };
+
+    enum CDRequestState : uint8_t {
+        CD_REQUEST_IDLE,
+        CD_REQUEST_PENDING,
+        CD_REQUEST_DONE,
+        CD_REQUEST_FAILED
+    };
+
+    // owned by whoever submits it, must stay alive until it's done or cancelled
+    struct CDRequest {
+        uint32_t lba;
+        uint32_t numSectors;
+        void *output; // numSectors * SECTOR_SIZE bytes, 4 byte aligned
+        uint8_t priority;
+
+        // managed by the scheduler
+        volatile CDRequestState state;
+        uint32_t waited; // service() calls spent pending, for aging
+        CDRequest *next;
+
+        CDRequest(void) : lba(0), numSectors(0), output(nullptr), priority(CD_PRIORITY_NORMAL), state(CD_REQUEST_IDLE), waited(0), next(nullptr) {}
+        bool isDone(void) const {return (state == CD_REQUEST_DONE) || (state == CD_REQUEST_FAILED);}
+    };
+
+    struct CDSchedulerStats {
+        uint32_t runs;      // reads issued to the drive
+        uint32_t requests;  // requests completed
+        uint32_t merged;    // requests that shared a run with another one
+        uint32_t gapsectors; // sectors read only to avoid a seek
+        uint64_t seekdistance; // sum of |run start - head| in sectors
+    };
+
+    // sits in front of the drive and decides what to read next. requests
+    // are served in elevator (scan) order from the current head position,
+    // highest priority class first, and neighbouring or overlapping ones
+    // are merged into a single read. anything left waiting long enough gets
+    // bumped up a priority step so it can't starve forever
+    class CDScheduler {
+    public:
+        CDScheduler(CDDrive *_drive) : drive(_drive), pending(nullptr), ascending(true), numrun(0), stats{} {}
+
+        void submit(CDRequest *request);
+        // only works while the request hasn't been picked up yet
+        bool cancel(CDRequest *request);
+
+        // blocking: reads one (merged) run, returns false if there was nothing to do
+        bool service(void);
+        // services until nothing is pending
+        void flush(void) {while (service()) {}}
+        // non blocking, call once per frame: finishes the run in flight once
+        // the drive is done and starts the next one. returns false when idle
+        bool update(void);
+
+        bool isIdle(void) const {return !pending && !numrun;}
+        const CDSchedulerStats &getStats(void) const {return stats;}
+        void resetStats(void) {stats = {};}
+    private:
+        CDDrive *drive;
+        CDRequest *pending;
+        bool ascending;
+        int numrun; // requests in the run being read, 0 when none is in flight
+        uint32_t runstart, runcount;
+        CDSchedulerStats stats;
+
+        // run being read
+        CDRequest *run[CONST::CD_MAX_RUN_REQUESTS];
+        TEMPLATES::UniquePtr<void *[]> ptrs;
+        TEMPLATES::UniquePtr<uint8_t[]> owners; // index into run for each sector
+        uint32_t ptrcapacity = 0;
+        uint32_t scratch[CONST::SECTOR_SIZE / 4]; // gap sectors land here
+
+        static uint32_t getPriority(const CDRequest *request);
+        CDRequest *pickNext(void);
+        void unlink(CDRequest *request);
+        void buildRun(void);
+        void finishRun(bool ok);
+    };
+
+#ifndef PLATFORM_PSX
+    namespace GENERIC {
+
+        // a drive backed by a disc image (2048 byte iso or raw 2352 byte bin)
+        // that takes about as long as the real one: seeks cost time depending
+        // on how far the head moves and sectors come in at 75 or 150 per
+        // second. a worker thread does the reading and calls back once per
+        // sector like the data ready irq, so the filesystem, caches and the
+        // scheduler can be run and benchmarked on pc
+        class SimCDDrive : public CDDrive {
+        public:
+            // runs on the worker thread after each sector landed (or failed)
+            using SectorCallback = void (*)(void *arg, uint32_t lba, bool ok);
+
+            SimCDDrive(void);
+            ~SimCDDrive(void);
+
+            bool open(const char *path);
+            void close(void);
+            uint32_t getNumSectors(void) const {return numsectors;}
+
+            // same as CDRom, without wait these return once the read is queued
+            bool startRead(uint32_t lba, void *ptr, int numSectors, bool doubleSpeed, bool wait);
+            bool startReadScatter(uint32_t lba, void *const *ptrs, int numSectors, bool doubleSpeed, bool wait);
+            // blocks until the current read is over, false if it failed
+            bool waitRead(void);
+            bool isBusy(void) const {return busy.load(std::memory_order_acquire);}
+            void setCallback(SectorCallback _callback, void *_arg);
+
+            // CDDrive
+            bool read(uint32_t lba, void *ptr, int numSectors) {
+                return startRead(lba, ptr, numSectors, true, true);
+            }
+            bool readSectors(uint32_t lba, void *const *ptrs, int numSectors) {
+                return startReadScatter(lba, ptrs, numSectors, true, true);
+            }
+            uint32_t getHeadLBA(void) const {return head.load(std::memory_order_acquire);}
+            bool readAsync(uint32_t lba, void *ptr, int numSectors);
+            bool readSectorsAsync(uint32_t lba, void *const *ptrs, int numSectors);
+            CDAsyncState pollAsync(void);
+
+            // 1 is real time, 0 doesn't sleep at all and only adds up the
+            // simulated time, which is what benchmarks want
+            void setTimeScale(float scale) {timescale = scale;}
+            uint64_t getSimulatedUS(void) const {return simulatedus.load(std::memory_order_acquire);}
+            uint32_t getSeeks(void) const {return seeks.load(std::memory_order_acquire);}
+            uint32_t getSectorsRead(void) const {return sectorsread.load(std::memory_order_acquire);}
+            void resetStats(void);
+
+        private:
+            FILE *image;
+            uint32_t numsectors;
+            uint32_t rawsize, dataoffset; // sector stride in the image and where the 2048 bytes start
+
+            std::thread worker;
+            std::mutex lock;
+            std::condition_variable wake, finished;
+            bool quit, result;
+            CDAsyncState asyncstate;
+            std::atomic<bool> busy;
+
+            // request handed to the worker, only touched under lock while busy is false
+            uint32_t reqLBA;
+            int reqNumSectors;
+            void *reqPtr;
+            void *const *reqPtrList;
+            bool reqDoubleSpeed, reqAsync;
+            SectorCallback callback;
+            void *callbackarg;
+
+            float timescale;
+            bool doubleSpeed;
+            std::atomic<uint32_t> head;
+            std::atomic<uint64_t> simulatedus;
+            std::atomic<uint32_t> seeks, sectorsread;
+
+            bool queueRead(uint32_t lba, void *ptr, void *const *ptrs, int numSectors, bool doubleSpeed, bool wait, bool async = false);
+            void run(void);
+            bool readSector(uint32_t lba, void *output);
+            uint32_t getSeekUS(uint32_t from, uint32_t to) const;
+        };
+    } //namespace GENERIC
+#endif
+
+} //namespace ENGINE
@@ -13,8 +13,13 @@ namespace ENGINE::COMMON {
     class Scene {
     public:
         inline Scene(void) {}
+        // called FIXED_STEP_RATE times per second, put physics/gameplay here
+        virtual void fixedUpdate(void) {}
+        // called once per rendered frame
         virtual void update(void) {}
-        virtual void draw(void) {}
+        // alpha is how far (0 to GTE_ONE) we are between the last two
+        // fixedUpdate calls, use it to interpolate positions when drawing
+        virtual void draw(int32_t alpha) {}
         virtual ~Scene(void) {}
     };
 
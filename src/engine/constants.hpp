@@ -10,12 +10,71 @@ namespace ENGINE::CONST {
     constexpr uint16_t CHAIN_BUFFER_SIZE   = 4104;
     constexpr uint16_t ORDERING_TABLE_SIZE = 1024;
     constexpr uint16_t SECTOR_SIZE = 2048;
+    constexpr uint16_t XA_SECTOR_SIZE      = 2340; //whole sector minus sync, what the drive sends in xa mode
+    constexpr uint8_t  XA_DATA_SLOTS       = 4;    //data sectors buffered while streaming xa
+    constexpr uint8_t  STREAM_SECTORS      = 16;   //ring size for CDRom::startStream, 32kb
+    constexpr uint8_t  STREAM_RESUME       = 8;    //free sectors needed before a paused stream restarts
+    constexpr uint8_t  SECTOR_CACHE_SIZE   = 16;   //sectors shared by all open files, 32kb
+    constexpr uint8_t  SECTOR_READAHEAD    = 4;    //extra sectors fetched once a file is read sequentially
+    constexpr uint8_t  READ_IDLE_SECTORS   = 8;    //sectors the drive keeps reading after a request before pausing
+    constexpr uint8_t  CD_READ_RETRIES     = 3;
+    constexpr uint32_t CD_ACK_TIMEOUT_MS    = 500;
+    constexpr uint32_t CD_SECTOR_TIMEOUT_MS = 2000; //covers a full seek plus spinning up from standby
+    constexpr uint32_t CD_RESET_TIMEOUT_MS  = 5000;
+
+    // CDScheduler, see cddrive.hpp
+    constexpr uint8_t  CD_MAX_RUN_REQUESTS = 16; //requests merged into one read at most
+    constexpr uint32_t CD_MAX_RUN_SECTORS  = 64; //merging stops growing a read past this
+    constexpr uint32_t CD_MERGE_GAP        = 8;  //unrequested sectors worth reading instead of seeking
+    constexpr uint32_t CD_AGING_SERVICES   = 8;  //reads a request can be passed over before it's bumped
+    constexpr uint8_t  CD_AGING_STEP       = 64; //priority gained per bump, one CDPriority class
+
+    // adaptive frame pacing, see Renderer::setFrameDivisor()
+    constexpr uint8_t FRAME_DIVISOR_MAX      = 3;  // 60/30/20fps on ntsc, 50/25/16 on pal
+    constexpr uint8_t FRAME_DIVISOR_UP       = 2;  // frames over budget before dropping the rate
+    constexpr uint8_t FRAME_DIVISOR_DOWN     = 60; // frames under budget before raising it again
+    constexpr uint8_t FRAME_DIVISOR_HEADROOM = 80; // % of the faster budget a frame must fit in
     // The GTE uses a 20.12 fixed-point format for most values. What this means is
     // that fractional values will be stored as integers by multiplying them by a
     // fixed unit, in this case 4096 or 1 << 12 (hence making the fractional part 12
     // bits long). We'll define this unit value to make their handling easier.
     constexpr uint16_t GTE_ONE = (1 << 12);
 
+    constexpr uint8_t MODEL_LOD_MAX_ERROR  = 1;  //pixels a coarser lod may be off by on screen
+    constexpr uint8_t MODEL_LOD_HYSTERESIS = 25; //% further a model has to get before dropping to a coarser lod
+
 
     constexpr uint8_t ASSET_MAX = 32;
+    constexpr uint8_t  ASSET_MAX_REQUESTS      = 8;    //AssetManager::requestAsync calls in flight
+    constexpr uint8_t  ASSET_PATH_MAX          = 64;
+    constexpr uint32_t ASSET_DECODE_BUDGET_US  = 2000; //decoding time per frame for async loads
+    constexpr uint8_t  ASSET_CHUNK_SECTORS     = 8;    //packed assets are read and unpacked this much at a time
+    constexpr uint8_t  ASSET_CHUNKS_AHEAD      = 2;    //chunk reads kept queued so the drive never waits on unpacking
+    // what AssetManager keeps loaded (in use or cached) at most
+    constexpr uint32_t ASSET_BUDGET_RAM        = 768 * 1024;
+    constexpr uint32_t ASSET_BUDGET_VRAM       = 640 * 1024; //1mb minus two 320x240 framebuffers and change
+    constexpr uint32_t ASSET_BUDGET_SPU        = 448 * 1024; //512kb minus the reverb area
+    constexpr uint8_t FILE_ASYNC_READS = 16; //File::readAsync calls in flight at once
+
+    constexpr uint8_t  AUDIO_NUM_VOICES     = 24; //same as the spu
+    constexpr int16_t  AUDIO_MAX_VOLUME     = 0x3fff;
+    constexpr uint16_t AUDIO_MAX_PITCH      = 0x3fff; //4x, the highest the spu plays at
+    constexpr uint8_t  AUDIO_SPU_MAX_BLOCKS = 64; //max spu ram allocations (free blocks included)
+
+    //only useful on pc
+    constexpr uint32_t AUDIO_OUTPUT_RATE    = 44100;
+    constexpr uint16_t AUDIO_BUFFER_FRAMES  = 512;
+    constexpr uint32_t AUDIO_COMMAND_RING   = 256; //must be a power of 2
+    constexpr uint8_t  FILE_IO_THREADS      = 2;   //workers serving File::readAsync
+
+    // SimCDDrive timings, roughly what a ps1 drive does
+    constexpr uint32_t CD_SIM_SECTORS_PER_SEC = 75;     //at 1x, doubled at 2x
+    constexpr uint32_t CD_SIM_SEEK_BASE_US    = 30000;  //any seek, however short
+    constexpr uint32_t CD_SIM_SEEK_FULL_US    = 300000; //extra for going across the whole disc
+    constexpr uint32_t CD_SIM_SPEED_CHANGE_US = 80000;  //spindle settling after switching 1x/2x
+
+    // simulation rate for Scene::fixedUpdate, independent of PAL/NTSC refresh
+    constexpr uint32_t FIXED_STEP_RATE      = 60;
+    // max fixedUpdate calls per frame before the backlog is dropped
+    constexpr uint32_t FIXED_STEP_MAX_STEPS = 4;
 } //namespace ENGINE::CONST
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "filesystem.hpp"
+#include <stdlib.h>
 
 namespace ENGINE {
 
@@ -9,9 +10,91 @@ namespace ENGINE {
 #ifdef PLATFORM_PSX
         instance = new PSX::PSXFileSystem();
 #else
+        // PSXRP_IMAGE=PSXRP.bin runs off the disc image through a simulated
+        // drive instead of the host filesystem, timings included
+        static GENERIC::SimCDDrive *drive;
+        const char *image = getenv("PSXRP_IMAGE");
+
+        if (image) {
+            drive = new GENERIC::SimCDDrive();
+            if (drive->open(image)) {
+                instance = new ISOFileSystem(drive);
+                return *instance;
+            }
+            delete drive;
+            drive = nullptr;
+        }
         instance = new GENERIC::GenericFileSystem();
 #endif
         return *instance;
     }
 
-} //namespace ENGINE
\ No newline at end of file
+    AsyncReadHandle File::readAsync(void *buffer, uint32_t length, uint64_t offset, AsyncReadCallback callback, void *arg) {
+        return g_fileSystemInstance.get()->queueRead(this, buffer, length, offset, callback, arg);
+    }
+
+    AsyncRead *FileSystem::allocRead(File *file, void *buffer, uint32_t length, uint64_t offset, AsyncReadCallback callback, void *arg) {
+        for (auto &read : asyncreads) {
+            if (read.handle)
+                continue;
+
+            read.handle   = nexthandle++;
+            read.file     = file;
+            read.buffer   = buffer;
+            read.length   = length;
+            read.offset   = offset;
+            read.callback = callback;
+            read.arg      = arg;
+            read.done     = false;
+            if (!nexthandle)
+                nexthandle = 1;
+            return &read;
+        }
+
+        return nullptr;
+    }
+
+    uint32_t FileSystem::readAt(File *file, void *buffer, uint32_t length, uint64_t offset) {
+        auto position = file->tell();
+        uint32_t result = 0;
+
+        if (file->seek(offset) == offset)
+            result = file->read(buffer, length);
+        file->seek(position);
+        return result;
+    }
+
+    AsyncReadHandle FileSystem::queueRead(File *file, void *buffer, uint32_t length, uint64_t offset, AsyncReadCallback callback, void *arg) {
+        auto read = allocRead(file, buffer, length, offset, callback, arg);
+        if (!read)
+            return 0;
+
+        read->length = readAt(file, buffer, length, offset);
+        read->done   = true;
+        return read->handle;
+    }
+
+    bool FileSystem::isReadPending(AsyncReadHandle handle) {
+        if (!handle)
+            return false;
+
+        for (auto &read : asyncreads)
+            if (read.handle == handle)
+                return true;
+        return false;
+    }
+
+    void FileSystem::update(void) {
+        // the slot is freed before the callback so it can queue another read
+        for (auto &read : asyncreads) {
+            if (!read.handle || !read.done)
+                continue;
+
+            AsyncRead finished = read;
+            read.handle = 0;
+            if (finished.callback)
+                finished.callback(finished.arg, finished.buffer, finished.length);
+        }
+    }
+
+} //namespace ENGINE
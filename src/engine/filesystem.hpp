@@ -1,21 +1,55 @@
 #pragma once 
 
 #include "templates.hpp"
+#include "constants.hpp"
+#include "cddrive.hpp"
 
 #ifdef PLATFORM_PSX
 #include "psx/cd.hpp"
 #else 
 #include <stdio.h>
 #include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
 #endif
 
 namespace ENGINE { 
 
+    class File;
+
+    using AsyncReadHandle   = uint32_t; // 0 is never handed out
+    // length is what was actually read, 0 on failure
+    using AsyncReadCallback = void (*)(void *arg, void *buffer, uint32_t length);
+
+    struct AsyncRead {
+        AsyncReadHandle handle; // 0 while the slot is free
+        File *file;
+        void *buffer;
+        uint32_t length;
+        uint64_t offset;
+        AsyncReadCallback callback;
+        void *arg;
+        bool done;
+    };
+
     class File {
     public:
         virtual uint32_t read(void *output, uint32_t length) { return 0; }
         virtual uint64_t seek(uint64_t offset) { return 0; }
         virtual uint64_t tell(void) { return 0; }
+        // the whole file in memory, if the backend can do that without a
+        // copy (mmap on pc). nullptr means read() is the only way
+        virtual const void *data(void) const { return nullptr; }
+        // reads length bytes at offset into buffer without moving the file
+        // position. the callback runs on the main thread from
+        // FileSystem::update(), the file and buffer must stay alive until
+        // then. returns 0 when too many reads are in flight
+        AsyncReadHandle readAsync(void *buffer, uint32_t length, uint64_t offset, AsyncReadCallback callback, void *arg = nullptr);
+        virtual ~File() = default;
         uint64_t getSize(void) const { return _size; }
     protected:
         uint64_t _size;
@@ -24,148 +58,272 @@ namespace ENGINE {
     class FileSystem {
     public:
         static FileSystem &instance();
+        // nullptr if there's no such file
         virtual File *findFile(const char *path) { return nullptr; }
+
+        // runs the callbacks of finished async reads, call once per frame
+        virtual void update(void);
+        virtual AsyncReadHandle queueRead(File *file, void *buffer, uint32_t length, uint64_t offset, AsyncReadCallback callback, void *arg);
+        virtual bool isReadPending(AsyncReadHandle handle);
     protected:
-        FileSystem() {}
+        // the default backend reads right away and only defers the callback
+        AsyncRead asyncreads[CONST::FILE_ASYNC_READS];
+        AsyncReadHandle nexthandle;
+
+        AsyncRead *allocRead(File *file, void *buffer, uint32_t length, uint64_t offset, AsyncReadCallback callback, void *arg);
+        static uint32_t readAt(File *file, void *buffer, uint32_t length, uint64_t offset);
+
+        FileSystem() : asyncreads{}, nexthandle(1) {}
         virtual ~FileSystem() = default;
     };
  
     extern TEMPLATES::ServiceLocator<FileSystem> g_fileSystemInstance;
 
-    //psx
-#ifdef PLATFORM_PSX
-    namespace PSX {
-        namespace ISO9660 {
-            template<typename T> struct [[gnu::packed]] ISOInt {
-                T le, be;
-            };
+    //iso9660 on top of a CDDrive, the real one on psx or a simulated one on pc
+    namespace ISO9660 {
+        template<typename T> struct [[gnu::packed]] ISOInt {
+            T le, be;
+        };
 
-            struct [[gnu::packed]] ISODate {
-                uint8_t year, month, day, hour, minute, second, timezone;
-            };
+        struct [[gnu::packed]] ISODate {
+            uint8_t year, month, day, hour, minute, second, timezone;
+        };
 
-            enum ISORecordFlag : uint8_t {
-                FLAG_EXISTS       = 1 << 0,
-                FLAG_DIRECTORY    = 1 << 1,
-                FLAG_ASSOCIATED   = 1 << 2,
-                FLAG_EXT_ATTR     = 1 << 3,
-                FLAG_PROTECTION   = 1 << 4,
-                FLAG_MULTI_EXTENT = 1 << 7
-            };
+        enum ISORecordFlag : uint8_t {
+            FLAG_EXISTS       = 1 << 0,
+            FLAG_DIRECTORY    = 1 << 1,
+            FLAG_ASSOCIATED   = 1 << 2,
+            FLAG_EXT_ATTR     = 1 << 3,
+            FLAG_PROTECTION   = 1 << 4,
+            FLAG_MULTI_EXTENT = 1 << 7
+        };
 
-            using ISOUint16 = ISOInt<uint16_t>;
-            using ISOUint32 = ISOInt<uint32_t>;
-            using ISOChar  = char;
-
-            struct [[gnu::packed]] Entry {
-                uint8_t  length;                   
-                uint8_t  ext_attr_length;         
-                ISOUint32 lba;  
-                ISOUint32 datalength;
-                ISODate date;        //Recording date and time
-                uint8_t  flag;           
-                uint8_t  interleave_length;        
-                uint8_t  interleave_gap_size;    
-                ISOUint16 volumeid;      
-                uint8_t  name_length;  
-
-                inline const char *getName(void) const {
-                    return reinterpret_cast<const char *>(&name_length + 1);
-                }
-            };
+        using ISOUint16 = ISOInt<uint16_t>;
+        using ISOUint32 = ISOInt<uint32_t>;
+        using ISOChar  = char;
 
-            struct [[gnu::packed]] PVD {    
-                uint8_t type; 
-                uint8_t magic[5]; //always CD001
-                uint8_t version;  
-                uint8_t _unused1;
-                uint8_t sysid[32];
-                uint8_t volumeid[32];
-                uint8_t _unused2[8];
+        struct [[gnu::packed]] Entry {
+            uint8_t  length;                   
+            uint8_t  ext_attr_length;         
+            ISOUint32 lba;  
+            ISOUint32 datalength;
+            ISODate date;        //Recording date and time
+            uint8_t  flag;           
+            uint8_t  interleave_length;        
+            uint8_t  interleave_gap_size;    
+            ISOUint16 volumeid;      
+            uint8_t  name_length;  
 
-                ISOUint32 volumesize; 
+            inline const char *getName(void) const {
+                return reinterpret_cast<const char *>(&name_length + 1);
+            }
+        };
 
-                uint8_t  _unused3[32];       
+        struct [[gnu::packed]] PVD {    
+            uint8_t type; 
+            uint8_t magic[5]; //always CD001
+            uint8_t version;  
+            uint8_t _unused1;
+            uint8_t sysid[32];
+            uint8_t volumeid[32];
+            uint8_t _unused2[8];
 
-                ISOUint16 numvolumes;    
+            ISOUint32 volumesize; 
 
-                ISOUint16 volume;
+            uint8_t  _unused3[32];       
 
-                ISOUint16 blocksize;   
+            ISOUint16 numvolumes;    
 
-                ISOUint32 pathtablesize;
-                
-                uint32_t pathtable_le;         
-                uint32_t opt_pathtable_le;   
+            ISOUint16 volume;
 
-                uint32_t pathtable_be;         
-                uint32_t opt_pathtable_be;    
+            ISOUint16 blocksize;   
 
-                uint8_t  rootdir[34];       
+            ISOUint32 pathtablesize;
+            
+            uint32_t pathtable_le;         
+            uint32_t opt_pathtable_le;   
 
-                uint8_t  volumesetid[128];
-                uint8_t  publisherid[128];
-                uint8_t  datapreparerid[128];
-                uint8_t  appid[128];
-                uint8_t  copyright_fileid[37];
-                uint8_t  abstract_fileid[37];
-                uint8_t  bibliographic_fileid[37];
+            uint32_t pathtable_be;         
+            uint32_t opt_pathtable_be;    
 
-                uint8_t  creation_date[17];        // YYYYMMDDHHMMSSCC
-                uint8_t  modification_date[17];
-                uint8_t  expiration_date[17];
-                uint8_t  effective_date[17];
+            uint8_t  rootdir[34];       
 
-                uint8_t  filestructver;  
-                uint8_t  _unused4;          
+            uint8_t  volumesetid[128];
+            uint8_t  publisherid[128];
+            uint8_t  datapreparerid[128];
+            uint8_t  appid[128];
+            uint8_t  copyright_fileid[37];
+            uint8_t  abstract_fileid[37];
+            uint8_t  bibliographic_fileid[37];
 
-                uint8_t  application_data[512]; 
-                uint8_t  _unused5[653];            
-            };
-            static_assert(sizeof(PVD) == 2048, "PVD must be exactly 2048 bytes");
-        } //namespace ISO9660
-        
-        class PSXFile : public File {
-            friend class PSXFileSystem;
-        public:
-            uint32_t read(void *output, uint32_t length);
-            uint64_t seek(uint64_t offset);
-            uint64_t tell(void) { return _offset; }
-        protected:
-        	uint32_t _startLBA;
-            uint32_t _bufferedLBA;
-            uint8_t  _sectorBuffer[SECTOR_SIZE];    
-            uint64_t _offset;
-            bool loadSector(uint32_t lba);
+            uint8_t  creation_date[17];        // YYYYMMDDHHMMSSCC
+            uint8_t  modification_date[17];
+            uint8_t  expiration_date[17];
+            uint8_t  effective_date[17];
+
+            uint8_t  filestructver;  
+            uint8_t  _unused4;          
+
+            uint8_t  application_data[512]; 
+            uint8_t  _unused5[653];            
         };
+        static_assert(sizeof(PVD) == 2048, "PVD must be exactly 2048 bytes");
+    } //namespace ISO9660
+    
+    // lru cache of disc sectors shared by every file. a miss can fetch a
+    // few of the following sectors in the same read, which is what makes
+    // small sequential reads (headers, tables...) cheap
+    class SectorCache {
+    public:
+        SectorCache(void) : drive(nullptr), numentries(0), usecounter(0), hits(0), misses(0), readaheads(0) {}
+
+        void init(CDDrive *_drive, int numSectors);
+        // returned pointer is valid until the next get(). readahead extra
+        // sectors are fetched on a miss, never reaching endLBA
+        const uint8_t *get(uint32_t lba, uint32_t readahead, uint32_t endLBA);
+        void invalidate(void);
+
+        uint32_t getHits(void) const {return hits;}
+        uint32_t getMisses(void) const {return misses;}
+        uint32_t getReadAheads(void) const {return readaheads;} //sectors fetched before being asked for
+        void resetStats(void) {hits = misses = readaheads = 0;}
+    private:
+        struct Entry {
+            uint32_t lba;
+            uint32_t lastuse;
+        };
+
+        CDDrive *drive;
+        TEMPLATES::UniquePtr<Entry[]> entries;
+        TEMPLATES::UniquePtr<uint32_t[]> data;
+        int numentries;
+        uint32_t usecounter;
+        uint32_t hits, misses, readaheads;
 
-        class PSXFileSystem : public FileSystem {
+        int find(uint32_t lba) const;
+        int findVictim(void) const;
+        uint8_t *getData(int index) {
+            return reinterpret_cast<uint8_t *>(&data[index * (ENGINE::CONST::SECTOR_SIZE / 4)]);
+        }
+    };
+
+    class ISOFile : public File {
+        friend class ISOFileSystem;
+    public:
+        uint32_t read(void *output, uint32_t length);
+        uint64_t seek(uint64_t offset);
+        uint64_t tell(void) { return _offset; }
+        // for handing the file to the drive directly, eg. CDRom::startXA()
+        uint32_t getLBA(void) const { return _startLBA; }
+        uint32_t getNumSectors(void) const { return uint32_t((_size + ENGINE::CONST::SECTOR_SIZE - 1) / ENGINE::CONST::SECTOR_SIZE); }
+    protected:
+    	uint32_t _startLBA;
+        uint32_t _lastLBA; // last sector read through the cache, for spotting sequential access
+        uint64_t _offset;
+        CDDrive *_drive;
+        SectorCache *_cache;
+    };
+
+    class ISOFileSystem : public FileSystem {
+    public:
+        ISOFileSystem(CDDrive *drive);	
+        File *findFile(const char *path); 
+        SectorCache &getCache(void) {return cache;}
+        CDDrive *getDrive(void) {return drive;}
+        CDScheduler &getScheduler(void) {return scheduler;}
+
+        // whole sectors of async reads go through the scheduler, so reads
+        // queued together are served in disc order and neighbours share a
+        // seek. a partial sector at the end is read once the rest is in,
+        // reads that don't start on a sector are done right away
+        void update(void);
+        AsyncReadHandle queueRead(File *file, void *buffer, uint32_t length, uint64_t offset, AsyncReadCallback callback, void *arg);
+    private:
+        CDDrive *drive;
+        CDScheduler scheduler;
+        CDRequest requests[CONST::FILE_ASYNC_READS]; // one per async read slot
+        SectorCache cache;
+        const ISO9660::Entry* rootdir;
+        ISO9660::PVD pvd;
+    };
+
+#ifdef PLATFORM_PSX
+    namespace PSX {
+        using PSXFile = ISOFile;
+
+        class PSXFileSystem : public ISOFileSystem {
         public:
-            PSXFileSystem(void);	
-            File *findFile(const char *path); 
-        private:
-            const ISO9660::Entry* rootdir;
-            ISO9660::PVD pvd;
+            PSXFileSystem(void) : ISOFileSystem(g_CDInstance.get()) {}
         };
     } //namespace PSX
 #else 
     namespace GENERIC {
 
+        // mapped into memory when the os allows it, plain stdio otherwise
         class GenericFile : public File {
             friend class GenericFileSystem;
         public:
             uint32_t read(void *output, uint32_t length);
             uint64_t seek(uint64_t offset);
-            uint64_t tell(void) { return ftell(_handle); }
+            uint64_t tell(void) { return _map ? _offset : ftell(_handle); }
+            const void *data(void) const { return _map; }
+            ~GenericFile(void);
         protected:
+            // safe to call from any thread, doesn't touch the file position
+            uint32_t readAt(void *output, uint32_t length, uint64_t offset);
+
             FILE* _handle;
-            ~GenericFile(void) {if (_handle) fclose(_handle);}
+            const uint8_t *_map;
+            uint64_t _offset; // only used when mapped
+
+            GenericFile(void) : _handle(nullptr), _map(nullptr), _offset(0) {}
         };
 
+        // async reads are done by a few worker threads so the main thread
+        // never waits on the disk
         class GenericFileSystem : public FileSystem {
         public:
             GenericFileSystem(void);	
+            ~GenericFileSystem(void);
             File *findFile(const char *path); 
+
+            void update(void);
+            AsyncReadHandle queueRead(File *file, void *buffer, uint32_t length, uint64_t offset, AsyncReadCallback callback, void *arg);
+            bool isReadPending(AsyncReadHandle handle);
+        private:
+            std::thread workers[CONST::FILE_IO_THREADS];
+            std::mutex lock;
+            std::condition_variable wake;
+            std::deque<AsyncRead *> queue;
+            bool quit;
+
+            void run(void);
+        };
+
+        // reports files written under a directory tree, so assets and
+        // shaders can be reloaded while the game runs. inotify, so linux
+        // only, watch() fails elsewhere
+        class FileWatcher {
+        public:
+            using Callback = void (*)(void *arg, const char *path);
+
+            FileWatcher(void) : fd(-1) {}
+            ~FileWatcher(void);
+
+            bool watch(const char *dir);
+            // calls back once per changed file since the last poll, paths are
+            // dir/... as passed to watch(). never blocks, call between frames
+            void poll(Callback callback, void *arg);
+        private:
+            struct Watch {
+                int wd;
+                std::string path;
+            };
+
+            int fd;
+            std::vector<Watch> watches;
+
+            bool addWatch(const std::string &path, std::vector<std::string> *found);
         };
     } //namespace GENERIC
 #endif
@@ -4,15 +4,24 @@
 namespace ENGINE::GENERIC {
 
     static std::chrono::steady_clock::time_point start;
-    
+
     ChronoTimer::ChronoTimer(void) {
         start = std::chrono::steady_clock::now();
     }
 
-    uint64_t ChronoTimer::getMS(void) {
+    //ticks are nanoseconds since the timer was created
+    uint64_t ChronoTimer::getTicks(void) {
         auto end = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
 
         return elapsed.count();
     };
-} //ENGINE::GENERIC 
\ No newline at end of file
+
+    uint64_t ChronoTimer::ticksToUS(uint64_t ticks) {
+        return ticks / 1000;
+    };
+
+    uint64_t ChronoTimer::ticksToMS(uint64_t ticks) {
+        return ticks / 1000000;
+    };
+} //ENGINE::GENERIC
\ No newline at end of file
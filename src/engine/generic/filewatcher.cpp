@@ -0,0 +1,114 @@
+#include "../filesystem.hpp"
+#include <stdio.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace ENGINE::GENERIC {
+
+#ifdef __linux__
+    // close_write catches regular saves, moved_to the editors that write a
+    // temp file and rename it over the original
+    static constexpr uint32_t WATCH_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+
+    FileWatcher::~FileWatcher(void) {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool FileWatcher::addWatch(const std::string &path, std::vector<std::string> *found) {
+        int wd = inotify_add_watch(fd, path.c_str(), WATCH_EVENTS | IN_ONLYDIR);
+        if (wd < 0)
+            return false;
+        watches.push_back({wd, path});
+
+        // inotify isn't recursive, every subdirectory needs its own watch.
+        // files already in a directory that just showed up count as changed,
+        // they were written before the watch existed
+        DIR *dir = opendir(path.c_str());
+        if (!dir)
+            return true;
+        while (auto ent = readdir(dir)) {
+            if (ent->d_name[0] == '.')
+                continue;
+            if (ent->d_type == DT_DIR)
+                addWatch(path + "/" + ent->d_name, found);
+            else if (found)
+                found->push_back(path + "/" + ent->d_name);
+        }
+        closedir(dir);
+        return true;
+    }
+
+    bool FileWatcher::watch(const char *dir) {
+        if (fd < 0)
+            fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        if (!addWatch(dir, nullptr)) {
+            printf("can't watch %s for changes\n", dir);
+            return false;
+        }
+        printf("watching %s for changes (%zu directories)\n", dir, watches.size());
+        return true;
+    }
+
+    void FileWatcher::poll(Callback callback, void *arg) {
+        if (fd < 0)
+            return;
+
+        // one save usually fires several events, report each file once
+        std::vector<std::string> changed;
+        alignas(struct inotify_event) char buffer[4096];
+
+        for (;;) {
+            ssize_t length = read(fd, buffer, sizeof(buffer));
+            if (length <= 0)
+                break;
+
+            for (ssize_t offset = 0; offset < length;) {
+                auto event = reinterpret_cast<const struct inotify_event *>(&buffer[offset]);
+                offset += sizeof(struct inotify_event) + event->len;
+
+                if (!event->len || (event->name[0] == '.'))
+                    continue;
+
+                const std::string *dir = nullptr;
+                for (auto &watch : watches)
+                    if (watch.wd == event->wd)
+                        dir = &watch.path;
+                if (!dir)
+                    continue;
+
+                std::string path = *dir + "/" + event->name;
+                if (event->mask & IN_ISDIR) {
+                    if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                        addWatch(path, &changed);
+                    continue;
+                }
+                if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                    changed.push_back(path); //plain creates are followed by a write
+            }
+        }
+
+        for (size_t i = 0; i < changed.size(); i++) {
+            bool seen = false;
+            for (size_t j = 0; j < i; j++)
+                seen |= (changed[j] == changed[i]);
+            if (!seen)
+                callback(arg, changed[i].c_str());
+        }
+    }
+#else
+    FileWatcher::~FileWatcher(void) {}
+    bool FileWatcher::addWatch(const std::string &path, std::vector<std::string> *found) { return false; }
+    bool FileWatcher::watch(const char *dir) { return false; }
+    void FileWatcher::poll(Callback callback, void *arg) {}
+#endif
+
+} //namespace ENGINE::GENERIC
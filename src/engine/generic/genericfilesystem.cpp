@@ -2,30 +2,116 @@
 #include <stdint.h>
 #include <assert.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace ENGINE::GENERIC {
 
     //file
     uint32_t GenericFile::read(void *output, uint32_t length) {  
+        if (_map) {
+            if (length > _size - _offset)
+                length = uint32_t(_size - _offset);
+            __builtin_memcpy(output, _map + _offset, length);
+            _offset += length;
+            return length;
+        }
+
         return fread(output, 1, length, _handle);
     }
 
     uint64_t GenericFile::seek(uint64_t offset) {
+        if (_map) {
+            _offset = (offset < _size) ? offset : _size;
+            return _offset;
+        }
         if (!_handle) return 0;
 
         fseek(_handle, offset, SEEK_SET);
         return ftell(_handle);
     }
 
+    uint32_t GenericFile::readAt(void *output, uint32_t length, uint64_t offset) {
+        if (offset >= _size)
+            return 0;
+        if (length > _size - offset)
+            length = uint32_t(_size - offset);
+
+        if (_map) {
+            __builtin_memcpy(output, _map + offset, length);
+            return length;
+        }
+
+#ifdef HAVE_MMAP
+        ssize_t result = pread(fileno(_handle), output, length, offset);
+        return (result > 0) ? uint32_t(result) : 0;
+#else
+        return 0; // not reached, queueRead only hands mapped files to the workers here
+#endif
+    }
+
+    GenericFile::~GenericFile(void) {
+#ifdef HAVE_MMAP
+        if (_map)
+            munmap(const_cast<uint8_t *>(_map), _size);
+#endif
+        if (_handle)
+            fclose(_handle);
+    }
+
 
-    GenericFileSystem::GenericFileSystem(void) {
-        //nothing to initialize
+    GenericFileSystem::GenericFileSystem(void) : quit(false) {
+        for (auto &worker : workers)
+            worker = std::thread(&GenericFileSystem::run, this);
+    }
+
+    GenericFileSystem::~GenericFileSystem(void) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers)
+            worker.join();
     }
 
     File *GenericFileSystem::findFile(const char *path) {
         GenericFile *file = new GenericFile();
         assert(file);
+
+#ifdef HAVE_MMAP
+        // the mapping stays valid after the descriptor is closed. empty files
+        // can't be mapped and go through stdio like everything else
+        int fd = open(path, O_RDONLY);
+        struct stat info;
+
+        if ((fd >= 0) && !fstat(fd, &info) && (info.st_size > 0)) {
+            void *map = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (map != MAP_FAILED) {
+                // assets are mostly parsed front to back right after opening
+                madvise(map, info.st_size, MADV_WILLNEED);
+                close(fd);
+
+                file->_map  = reinterpret_cast<const uint8_t *>(map);
+                file->_size = info.st_size;
+                return file;
+            }
+        }
+        if (fd >= 0)
+            close(fd);
+#endif
+
         file->_handle = fopen(path, "rb");
-        assert(file->_handle);
+        if (!file->_handle) {
+            delete file;
+            return nullptr;
+        }
 
         //set filesize
         fseek(file->_handle, 0, SEEK_END);
@@ -35,4 +121,72 @@ namespace ENGINE::GENERIC {
         return file;
     }
 
-} //namespace ENGINE::GENERIC 
\ No newline at end of file
+    //async reads
+    AsyncReadHandle GenericFileSystem::queueRead(File *file, void *buffer, uint32_t length, uint64_t offset, AsyncReadCallback callback, void *arg) {
+#ifndef HAVE_MMAP
+        // without pread the workers would fight the main thread over the
+        // stdio file position
+        if (!file->data())
+            return FileSystem::queueRead(file, buffer, length, offset, callback, arg);
+#endif
+        AsyncRead *read;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            read = allocRead(file, buffer, length, offset, callback, arg);
+            if (!read)
+                return 0;
+            queue.push_back(read);
+        }
+        wake.notify_one();
+
+        return read->handle;
+    }
+
+    bool GenericFileSystem::isReadPending(AsyncReadHandle handle) {
+        std::unique_lock<std::mutex> guard(lock);
+        return FileSystem::isReadPending(handle);
+    }
+
+    void GenericFileSystem::update(void) {
+        // callbacks run without the lock held, they're free to queue more reads
+        AsyncRead finished[CONST::FILE_ASYNC_READS];
+        int numfinished = 0;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            for (auto &read : asyncreads) {
+                if (!read.handle || !read.done)
+                    continue;
+
+                finished[numfinished++] = read;
+                read.handle = 0;
+            }
+        }
+
+        for (int i = 0; i < numfinished; i++)
+            if (finished[i].callback)
+                finished[i].callback(finished[i].arg, finished[i].buffer, finished[i].length);
+    }
+
+    void GenericFileSystem::run(void) {
+        for (;;) {
+            AsyncRead *read;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [this] {return quit || !queue.empty();});
+                if (quit)
+                    return;
+
+                read = queue.front();
+                queue.pop_front();
+            }
+
+            // files only ever come from findFile() above
+            uint32_t result = static_cast<GenericFile *>(read->file)->readAt(read->buffer, read->length, read->offset);
+
+            std::unique_lock<std::mutex> guard(lock);
+            read->length = result;
+            read->done   = true;
+        }
+    }
+
+} //namespace ENGINE::GENERIC
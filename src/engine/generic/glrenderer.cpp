@@ -1,31 +1,51 @@
 #include "../renderer.hpp"
 #include "../filesystem.hpp"
+#include "../timer.hpp"
 #include "../constants.hpp"
 #include <glad/glad.h>
 #include <SDL2/SDL.h>
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
 
 namespace ENGINE::GENERIC {
+
+    static const char *VERTEX_SHADER_PATH   = "assets/vertex.glsl";
+    static const char *FRAGMENT_SHADER_PATH = "assets/fragment.glsl";
         
-    void GLShader::init(const char *path, GLenum type) {
+    bool GLShader::init(const char *path, GLenum type) {
         ENGINE::File *f = ENGINE::g_fileSystemInstance.get()->findFile(path);
-        uint32_t fsize = f->getSize();
-
-        char* src = new char[fsize + 1]; // +1 for null terminator
-        f->read(src, fsize);
-        src[fsize] = '\0';
-
-        const char* ptr = src;
+        if (!f) {
+            printf("%s: not found\n", path);
+            return false;
+        }
+        GLint fsize = GLint(f->getSize());
+
+        // a mapped file can go to gl as is, given the length
+        char *src = nullptr;
+        const char *ptr = reinterpret_cast<const char *>(f->data());
+        if (!ptr) {
+            src = new char[fsize];
+            f->read(src, fsize);
+            ptr = src;
+        }
 
         id = glCreateShader(type);
-        glShaderSource(id, 1, &ptr, NULL);
+        glShaderSource(id, 1, &ptr, &fsize);
         glCompileShader(id);
 
         int success;
         glGetShaderiv(id, GL_COMPILE_STATUS, &success);
-        assert(success);
         delete[] src; // clean up
-        
+        delete f;
+
+        if (!success) {
+            char log[512];
+            glGetShaderInfoLog(id, sizeof(log), nullptr, log);
+            printf("%s: %s\n", path, log);
+            glDeleteShader(id);
+        }
+        return success;
     }
 
     GLRenderer::GLRenderer(void) {
@@ -65,28 +85,91 @@ namespace ENGINE::GENERIC {
         assert(err);
 
         // link shaders
-        vertshader.init("assets/vertex.glsl", GL_VERTEX_SHADER);
-        fragshader.init("assets/fragment.glsl", GL_FRAGMENT_SHADER);
-        shaderprog = glCreateProgram();
-        glAttachShader(shaderprog, vertshader.getId());
-        glAttachShader(shaderprog, fragshader.getId());
-        glLinkProgram(shaderprog);
-        // check for linking errors
-        glGetProgramiv(shaderprog, GL_LINK_STATUS, &err);
+        shaderprog = 0;
+        err = buildProgram();
         assert(err);
-        vertshader.free();
-        fragshader.free();
 
         glViewport(0, 0, scrw, scrh);
         setClearCol(64, 64, 64);
+
+        // drivers rarely honour swap intervals above 1, so always sync to
+        // every vblank and hold back frames in endFrame() for the divisor
+        SDL_GL_SetSwapInterval(1);
+        SDL_DisplayMode mode;
+        refreshrate = ((SDL_GetWindowDisplayMode(window, &mode) == 0) && (mode.refresh_rate > 0)) ? mode.refresh_rate : 60;
+        lastpresent = 0;
+    }
+
+    bool GLRenderer::buildProgram(void) {
+        if (!vertshader.init(VERTEX_SHADER_PATH, GL_VERTEX_SHADER))
+            return false;
+        if (!fragshader.init(FRAGMENT_SHADER_PATH, GL_FRAGMENT_SHADER)) {
+            vertshader.free();
+            return false;
+        }
+
+        uint32_t prog = glCreateProgram();
+        glAttachShader(prog, vertshader.getId());
+        glAttachShader(prog, fragshader.getId());
+        glLinkProgram(prog);
+        vertshader.free();
+        fragshader.free();
+
+        // check for linking errors
+        int success;
+        glGetProgramiv(prog, GL_LINK_STATUS, &success);
+        if (!success) {
+            char log[512];
+            glGetProgramInfoLog(prog, sizeof(log), nullptr, log);
+            printf("shader link: %s\n", log);
+            glDeleteProgram(prog);
+            return false;
+        }
+
+        if (shaderprog)
+            glDeleteProgram(shaderprog);
+        shaderprog = prog;
+        return true;
+    }
+
+    void GLRenderer::onFileChanged(const char *path) {
+        if (strcmp(path, VERTEX_SHADER_PATH) && strcmp(path, FRAGMENT_SHADER_PATH))
+            return;
+
+        // a broken edit keeps the last good program running
+        if (buildProgram())
+            printf("reloaded shaders\n");
     }
 
     void GLRenderer::beginFrame(void) {
+        framestart = g_timerInstance.get()->getTicks();
         glClear(GL_COLOR_BUFFER_BIT);
     }
 
     void GLRenderer::endFrame(void) {
+        auto timer = g_timerInstance.get();
+        cputime = uint32_t(timer->ticksToUS(timer->getTicks() - framestart));
+
+        // sit out framedivisor - 1 vblanks since the last frame went up, the
+        // swap itself then waits for the next one
+        uint64_t wait = uint64_t(framedivisor - 1) * 1000000 / refreshrate;
+        for (;;) {
+            uint64_t elapsed = timer->ticksToUS(timer->getTicks() - lastpresent);
+            if (elapsed >= wait)
+                break;
+            if ((wait - elapsed) > 2000)
+                SDL_Delay(1); //spin the last bit, sleeps overshoot
+        }
+
         SDL_GL_SwapWindow(window);
+        lastpresent = timer->getTicks();
+    }
+
+    // there is no way to time the gpu here, so automatic mode just leaves the
+    // pacing to the driver (plain vsync)
+    void GLRenderer::setFrameDivisor(uint32_t divisor) {
+        autodivisor = !divisor;
+        framedivisor = divisor ? divisor : 1;
     }
         
     void GLRenderer::drawTri(const ENGINE::COMMON::TRI32 &tri, uint32_t z, uint32_t col) {
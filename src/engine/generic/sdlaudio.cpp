@@ -0,0 +1,331 @@
+#include "../audio.hpp"
+#include <SDL2/SDL.h>
+#include <assert.h>
+#include <stdio.h>
+
+namespace ENGINE::GENERIC {
+
+    enum ADPCMFlag : uint8_t {
+        ADPCM_END        = 1 << 0,
+        ADPCM_REPEAT     = 1 << 1,
+        ADPCM_LOOP_START = 1 << 2
+    };
+
+    // decodes spu adpcm the same way the spu does, 16 byte blocks holding a
+    // shift/filter byte, a flag byte and 28 4-bit samples
+    static void decodeADPCM(SDLSound *sound, const uint8_t *data, uint32_t length) {
+        static const int filterpos[5] = {0, 60, 115,  98, 122};
+        static const int filterneg[5] = {0,  0, -52, -55, -60};
+
+        uint32_t numblocks = length / 16;
+        sound->numsamples  = numblocks * 28;
+        sound->loopstart   = 0;
+        sound->samples.reset(new float[sound->numsamples + 1]);
+
+        auto out = sound->samples.get();
+        int  s1 = 0, s2 = 0;
+
+        for (uint32_t block = 0; block < numblocks; block++, data += 16) {
+            int shift  = data[0] & 0xf;
+            int filter = data[0] >> 4;
+            if (shift > 12)
+                shift = 9; //what the spu does with invalid values
+            if (filter > 4)
+                filter = 4;
+
+            if (data[1] & ADPCM_LOOP_START)
+                sound->loopstart = block * 28;
+
+            for (int i = 0; i < 28; i++) {
+                int nibble = (data[2 + (i / 2)] >> ((i % 2) * 4)) & 0xf;
+                int sample = int16_t(nibble << 12) >> shift;
+
+                sample += ((s1 * filterpos[filter]) + (s2 * filterneg[filter]) + 32) >> 6;
+                sample  = (sample < -0x8000) ? -0x8000 : ((sample > 0x7fff) ? 0x7fff : sample);
+
+                s2 = s1;
+                s1 = sample;
+                *(out++) = float(sample) * (1.0f / 32768.0f);
+            }
+        }
+
+        // guard sample for interpolating past the last one
+        sound->samples[sound->numsamples] = sound->loop ? sound->samples[sound->loopstart] : 0.0f;
+    }
+
+    // linear interpolation at a fixed step. the fetch is a gather, so this
+    // stays a scalar loop, unlike mixInto() below
+    static void resample(float *__restrict output, const float *__restrict input, uint64_t pos, uint64_t step, uint32_t frames) {
+        for (uint32_t i = 0; i < frames; i++) {
+            uint32_t index = uint32_t(pos >> 32);
+            float    frac  = float(uint32_t(pos) >> 8) * (1.0f / 16777216.0f);
+
+            output[i] = input[index] + ((input[index + 1] - input[index]) * frac);
+            pos += step;
+        }
+    }
+
+    static void mixInto(float *__restrict left, float *__restrict right, const float *__restrict input, float leftvol, float rightvol, uint32_t frames) {
+        for (uint32_t i = 0; i < frames; i++) {
+            left[i]  += input[i] * leftvol;
+            right[i] += input[i] * rightvol;
+        }
+    }
+
+    SDLAudio::SDLAudio(void) {
+        deferredcommands = 0;
+        for (int ch = 0; ch < CONST::AUDIO_NUM_VOICES; ch++) {
+            mixvoices[ch].active = false;
+            finished[ch].store(INVALID_VOICE);
+        }
+
+        SDL_AudioSpec want = {}, have;
+        want.freq     = CONST::AUDIO_OUTPUT_RATE;
+        want.format   = AUDIO_S16SYS;
+        want.channels = 2;
+        want.samples  = CONST::AUDIO_BUFFER_FRAMES;
+        want.callback = callback;
+        want.userdata = this;
+
+        device = 0;
+        if (SDL_InitSubSystem(SDL_INIT_AUDIO) == 0)
+            device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+
+        if (!device) {
+            // keep going without sound, everything below turns into a no-op
+            printf("failed to open audio device: %s\n", SDL_GetError());
+            return;
+        }
+
+        // all buffers the callback needs are allocated up front
+        outputrate = have.freq;
+        mixframes  = have.samples;
+        mixleft.reset(new float[mixframes]);
+        mixright.reset(new float[mixframes]);
+        resampled.reset(new float[mixframes]);
+
+        SDL_PauseAudioDevice(device, 0);
+    }
+
+    SDLAudio::~SDLAudio(void) {
+        if (device)
+            SDL_CloseAudioDevice(device);
+
+        for (auto &pending : pendingfrees)
+            delete pending.sound;
+    }
+
+    Sound *SDLAudio::loadSound(const void *data, uint32_t length, uint32_t samplerate) {
+        assert(length >= 16 && !(length % 16));
+
+        auto bytes     = reinterpret_cast<const uint8_t *>(data);
+        auto lastflags = bytes[length - 16 + 1];
+        auto sound     = new SDLSound();
+
+        sound->length     = length;
+        sound->samplerate = samplerate;
+        sound->basepitch  = basePitch(samplerate);
+        sound->loop       = (lastflags & (ADPCM_END | ADPCM_REPEAT)) == (ADPCM_END | ADPCM_REPEAT);
+        decodeADPCM(sound, bytes, length);
+
+        return sound;
+    }
+
+    void SDLAudio::freeSound(Sound *sound) {
+        if (!sound)
+            return;
+
+        stopSound(sound);
+        pendingfrees.push_back({static_cast<SDLSound *>(sound), uint32_t(commands.getPushed() + backlog.size())});
+    }
+
+    void SDLAudio::update(void) {
+        flushBacklog();
+
+        // free voices the callback reported as done, as long as they haven't
+        // been reused for another sound in the meantime
+        uint32_t endedmask = 0;
+        for (int ch = 0; ch < CONST::AUDIO_NUM_VOICES; ch++) {
+            int32_t handle = finished[ch].exchange(INVALID_VOICE);
+            if ((handle != INVALID_VOICE) && (getChannel(handle) == ch))
+                endedmask |= 1 << ch;
+        }
+        releaseChannels(endedmask);
+
+        // delete sounds the callback can no longer be touching
+        uint32_t popped = commands.getPopped();
+        for (size_t i = 0; i < pendingfrees.size();) {
+            if (!device || (int32_t(popped - pendingfrees[i].seq) >= 0)) {
+                delete pendingfrees[i].sound;
+                pendingfrees[i] = pendingfrees.back();
+                pendingfrees.pop_back();
+            } else {
+                i++;
+            }
+        }
+    }
+
+    void SDLAudio::send(const Command &cmd) {
+        if (!device)
+            return;
+        // the callback drains the whole ring every few ms, it only fills up
+        // if the device stopped pulling data. nothing can be dropped (a lost
+        // stop would leave the callback playing a freed sound), so the rest
+        // waits here and keeps its order
+        flushBacklog();
+        if (!backlog.empty() || !commands.push(cmd)) {
+            backlog.push_back(cmd);
+            deferredcommands++;
+        }
+    }
+
+    void SDLAudio::flushBacklog(void) {
+        size_t sent = 0;
+        while ((sent < backlog.size()) && commands.push(backlog[sent]))
+            sent++;
+        backlog.erase(backlog.begin(), backlog.begin() + sent);
+    }
+
+    uint64_t SDLAudio::pitchToStep(uint16_t pitch) const {
+        // pitch 0x1000 plays one sample per output sample at 44100hz
+        uint64_t step = (uint64_t(pitch) << 20) * 44100 / outputrate;
+        return step ? step : 1;
+    }
+
+    void SDLAudio::startVoice(int ch, const Sound *sound, int16_t left, int16_t right, uint16_t pitch) {
+        Command cmd;
+        cmd.type   = CMD_START;
+        cmd.ch     = ch;
+        cmd.pitch  = pitch;
+        cmd.left   = left;
+        cmd.right  = right;
+        cmd.handle = (int32_t(voices[ch].generation) << 8) | ch;
+        cmd.sound  = static_cast<const SDLSound *>(sound);
+        send(cmd);
+    }
+
+    void SDLAudio::stopVoice(int ch) {
+        Command cmd;
+        cmd.type = CMD_STOP;
+        cmd.ch   = ch;
+        send(cmd);
+    }
+
+    void SDLAudio::setVoiceVolume(int ch, int16_t left, int16_t right) {
+        Command cmd;
+        cmd.type  = CMD_VOLUME;
+        cmd.ch    = ch;
+        cmd.left  = left;
+        cmd.right = right;
+        send(cmd);
+    }
+
+    void SDLAudio::setVoicePitch(int ch, uint16_t pitch) {
+        Command cmd;
+        cmd.type  = CMD_PITCH;
+        cmd.ch    = ch;
+        cmd.pitch = pitch;
+        send(cmd);
+    }
+
+    //audio thread from here on
+    void SDLAudio::callback(void *userdata, uint8_t *stream, int length) {
+        auto audio = reinterpret_cast<SDLAudio *>(userdata);
+        audio->mix(reinterpret_cast<int16_t *>(stream), uint32_t(length) / (sizeof(int16_t) * 2));
+    }
+
+    void SDLAudio::mix(int16_t *output, uint32_t frames) {
+        constexpr float VOLUME_SCALE = 1.0f / CONST::AUDIO_MAX_VOLUME;
+
+        Command cmd;
+        while (commands.pop(cmd)) {
+            auto &v = mixvoices[cmd.ch];
+
+            switch (cmd.type) {
+                case CMD_START:
+                    v.sound  = cmd.sound;
+                    v.pos    = 0;
+                    v.step   = pitchToStep(cmd.pitch);
+                    v.left   = cmd.left * VOLUME_SCALE;
+                    v.right  = cmd.right * VOLUME_SCALE;
+                    v.handle = cmd.handle;
+                    v.active = true;
+                    break;
+                case CMD_STOP:
+                    v.active = false;
+                    break;
+                case CMD_VOLUME:
+                    v.left  = cmd.left * VOLUME_SCALE;
+                    v.right = cmd.right * VOLUME_SCALE;
+                    break;
+                case CMD_PITCH:
+                    v.step = pitchToStep(cmd.pitch);
+                    break;
+            }
+        }
+
+        // sdl asks for at most the buffer size we got when opening, but
+        // handle bigger requests in pieces anyway
+        while (frames) {
+            uint32_t chunk = (frames < mixframes) ? frames : mixframes;
+
+            for (uint32_t i = 0; i < chunk; i++) {
+                mixleft[i]  = 0.0f;
+                mixright[i] = 0.0f;
+            }
+
+            for (int ch = 0; ch < CONST::AUDIO_NUM_VOICES; ch++) {
+                if (!mixvoices[ch].active)
+                    continue;
+
+                uint32_t done = mixVoice(ch, chunk);
+                mixInto(mixleft.get(), mixright.get(), resampled.get(), mixvoices[ch].left, mixvoices[ch].right, done);
+            }
+
+            for (uint32_t i = 0; i < chunk; i++) {
+                float left  = mixleft[i];
+                float right = mixright[i];
+
+                left  = (left  < -1.0f) ? -1.0f : ((left  > 1.0f) ? 1.0f : left);
+                right = (right < -1.0f) ? -1.0f : ((right > 1.0f) ? 1.0f : right);
+                output[(i * 2) + 0] = int16_t(left  * 32767.0f);
+                output[(i * 2) + 1] = int16_t(right * 32767.0f);
+            }
+
+            output += chunk * 2;
+            frames -= chunk;
+        }
+    }
+
+    // resamples up to frames samples of a voice into the resampled buffer,
+    // handling loops, and returns how many it produced
+    uint32_t SDLAudio::mixVoice(int ch, uint32_t frames) {
+        auto &v     = mixvoices[ch];
+        auto  sound = v.sound;
+        uint64_t end = uint64_t(sound->numsamples) << 32;
+        uint32_t done = 0;
+
+        while (done < frames) {
+            if (v.pos >= end) {
+                if (!sound->loop) {
+                    v.active = false;
+                    finished[ch].store(v.handle);
+                    break;
+                }
+
+                v.pos -= uint64_t(sound->numsamples - sound->loopstart) << 32;
+                continue;
+            }
+
+            uint64_t remaining = (end - v.pos + v.step - 1) / v.step;
+            uint32_t count = (remaining < (frames - done)) ? uint32_t(remaining) : (frames - done);
+
+            resample(&resampled[done], sound->samples.get(), v.pos, v.step, count);
+            v.pos += v.step * count;
+            done  += count;
+        }
+
+        return done;
+    }
+
+} //namespace ENGINE::GENERIC
\ No newline at end of file
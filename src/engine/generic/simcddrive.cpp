@@ -0,0 +1,236 @@
+#include "../cddrive.hpp"
+#include <assert.h>
+#include <string.h>
+#include <chrono>
+
+namespace ENGINE::GENERIC {
+
+    static constexpr uint32_t RAW_SECTOR_SIZE = 2352;
+    static const uint8_t SYNC_PATTERN[12] = {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
+
+    SimCDDrive::SimCDDrive(void)
+        : image(nullptr), numsectors(0), rawsize(CONST::SECTOR_SIZE), dataoffset(0),
+          quit(false), result(true), asyncstate(CD_ASYNC_IDLE), busy(false),
+          reqLBA(0), reqNumSectors(0), reqPtr(nullptr), reqPtrList(nullptr), reqDoubleSpeed(true), reqAsync(false),
+          callback(nullptr), callbackarg(nullptr),
+          timescale(1.0f), doubleSpeed(true), head(0), simulatedus(0), seeks(0), sectorsread(0) {
+        worker = std::thread(&SimCDDrive::run, this);
+    }
+
+    SimCDDrive::~SimCDDrive(void) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            quit = true;
+        }
+        wake.notify_all();
+        worker.join();
+        close();
+    }
+
+    bool SimCDDrive::open(const char *path) {
+        waitRead();
+        close();
+
+        image = fopen(path, "rb");
+        if (!image)
+            return false;
+
+        fseek(image, 0, SEEK_END);
+        long size = ftell(image);
+
+        // raw images start every sector with the sync pattern, mode 2 (what
+        // the ps1 uses) has an 8 byte subheader before the data
+        uint8_t header[16];
+        fseek(image, 0, SEEK_SET);
+        if (
+            !(size % RAW_SECTOR_SIZE) &&
+            (fread(header, 1, sizeof(header), image) == sizeof(header)) &&
+            !memcmp(header, SYNC_PATTERN, sizeof(SYNC_PATTERN))
+        ) {
+            rawsize    = RAW_SECTOR_SIZE;
+            dataoffset = (header[15] == 2) ? 24 : 16;
+        } else {
+            rawsize    = CONST::SECTOR_SIZE;
+            dataoffset = 0;
+        }
+
+        numsectors = uint32_t(size / rawsize);
+        head.store(0, std::memory_order_release);
+        printf("simcd: %s, %u sectors of %u bytes\n", path, numsectors, rawsize);
+        return true;
+    }
+
+    void SimCDDrive::close(void) {
+        if (image)
+            fclose(image);
+        image      = nullptr;
+        numsectors = 0;
+    }
+
+    void SimCDDrive::setCallback(SectorCallback _callback, void *_arg) {
+        std::unique_lock<std::mutex> guard(lock);
+        callback    = _callback;
+        callbackarg = _arg;
+    }
+
+    void SimCDDrive::resetStats(void) {
+        simulatedus.store(0, std::memory_order_release);
+        seeks.store(0, std::memory_order_release);
+        sectorsread.store(0, std::memory_order_release);
+    }
+
+    bool SimCDDrive::startRead(uint32_t lba, void *ptr, int numSectors, bool doubleSpeed, bool wait) {
+        return queueRead(lba, ptr, nullptr, numSectors, doubleSpeed, wait);
+    }
+
+    bool SimCDDrive::startReadScatter(uint32_t lba, void *const *ptrs, int numSectors, bool doubleSpeed, bool wait) {
+        return queueRead(lba, nullptr, ptrs, numSectors, doubleSpeed, wait);
+    }
+
+    bool SimCDDrive::readAsync(uint32_t lba, void *ptr, int numSectors) {
+        return queueRead(lba, ptr, nullptr, numSectors, true, false, true);
+    }
+
+    bool SimCDDrive::readSectorsAsync(uint32_t lba, void *const *ptrs, int numSectors) {
+        return queueRead(lba, nullptr, ptrs, numSectors, true, false, true);
+    }
+
+    CDAsyncState SimCDDrive::pollAsync(void) {
+        std::unique_lock<std::mutex> guard(lock);
+        return asyncstate;
+    }
+
+    bool SimCDDrive::queueRead(uint32_t lba, void *ptr, void *const *ptrs, int numSectors, bool doubleSpeed, bool wait, bool async) {
+        assert(numSectors > 0);
+        if (!image)
+            return false;
+
+        {
+            // like the real drive, one read at a time
+            std::unique_lock<std::mutex> guard(lock);
+            finished.wait(guard, [this] {return !busy.load(std::memory_order_acquire);});
+
+            reqLBA         = lba;
+            reqNumSectors  = numSectors;
+            reqPtr         = ptr;
+            reqPtrList     = ptrs;
+            reqDoubleSpeed = doubleSpeed;
+            reqAsync       = async;
+            result         = true;
+            if (async)
+                asyncstate = CD_ASYNC_BUSY;
+            busy.store(true, std::memory_order_release);
+        }
+        wake.notify_one();
+
+        if (wait)
+            return waitRead();
+        return true;
+    }
+
+    bool SimCDDrive::waitRead(void) {
+        std::unique_lock<std::mutex> guard(lock);
+        finished.wait(guard, [this] {return !busy.load(std::memory_order_acquire);});
+        return result;
+    }
+
+    uint32_t SimCDDrive::getSeekUS(uint32_t from, uint32_t to) const {
+        if (from == to)
+            return 0;
+
+        uint64_t distance = (from > to) ? (from - to) : (to - from);
+        uint64_t total    = numsectors ? numsectors : 1;
+        if (distance > total)
+            distance = total;
+        return CONST::CD_SIM_SEEK_BASE_US + uint32_t((CONST::CD_SIM_SEEK_FULL_US * distance) / total);
+    }
+
+    bool SimCDDrive::readSector(uint32_t lba, void *output) {
+        if (lba >= numsectors)
+            return false;
+        if (fseek(image, long(lba) * rawsize + dataoffset, SEEK_SET))
+            return false;
+        return fread(output, 1, CONST::SECTOR_SIZE, image) == CONST::SECTOR_SIZE;
+    }
+
+    void SimCDDrive::run(void) {
+        using clock = std::chrono::steady_clock;
+
+        for (;;) {
+            uint32_t lba;
+            int numSectors;
+            void *ptr;
+            void *const *ptrs;
+            bool speed, async;
+            SectorCallback cb;
+            void *cbarg;
+
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [this] {return quit || busy.load(std::memory_order_acquire);});
+                if (quit)
+                    return;
+
+                lba        = reqLBA;
+                numSectors = reqNumSectors;
+                ptr        = reqPtr;
+                ptrs       = reqPtrList;
+                speed      = reqDoubleSpeed;
+                async      = reqAsync;
+                cb         = callback;
+                cbarg      = callbackarg;
+            }
+
+            // every delay is added to a deadline rather than slept on its own,
+            // so the simulated rate doesn't drift with scheduling jitter
+            auto deadline = clock::now();
+            auto delay = [&](uint32_t us) {
+                simulatedus.fetch_add(us, std::memory_order_acq_rel);
+                if (timescale > 0.0f) {
+                    deadline += std::chrono::microseconds(uint64_t(us * timescale));
+                    std::this_thread::sleep_until(deadline);
+                }
+            };
+
+            if (speed != doubleSpeed) {
+                doubleSpeed = speed;
+                delay(CONST::CD_SIM_SPEED_CHANGE_US);
+            }
+
+            uint32_t current = head.load(std::memory_order_acquire);
+            if (current != lba) {
+                seeks.fetch_add(1, std::memory_order_acq_rel);
+                delay(getSeekUS(current, lba));
+            }
+
+            uint32_t sectorUS = 1000000 / (CONST::CD_SIM_SECTORS_PER_SEC * (speed ? 2 : 1));
+            bool ok = true;
+
+            for (int i = 0; i < numSectors; i++) {
+                delay(sectorUS);
+
+                void *output = ptrs ? ptrs[i] : (reinterpret_cast<uint8_t *>(ptr) + i * CONST::SECTOR_SIZE);
+                bool sectorok = readSector(lba + i, output);
+                head.store(lba + i + 1, std::memory_order_release);
+                sectorsread.fetch_add(1, std::memory_order_acq_rel);
+
+                if (cb)
+                    cb(cbarg, lba + i, sectorok);
+                if (!sectorok) {
+                    ok = false;
+                    break;
+                }
+            }
+
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                result = ok;
+                if (async)
+                    asyncstate = ok ? CD_ASYNC_DONE : CD_ASYNC_FAILED;
+                busy.store(false, std::memory_order_release);
+            }
+            finished.notify_all();
+        }
+    }
+
+} //namespace ENGINE::GENERIC
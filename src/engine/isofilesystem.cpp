@@ -0,0 +1,312 @@
+#include "filesystem.hpp"
+#include "common.hpp"
+#include <assert.h>
+#include <string.h>
+
+namespace ENGINE {
+   
+    // the entry found is copied out, the directory it was read from is gone
+    // by the time this returns
+    static bool getEntry(CDDrive *drive, const ISO9660::Entry *curdir, const char *path, ISO9660::Entry &result) {
+        if (!path || !path[0]) {
+            result = *curdir;
+            return true;
+        }
+
+        //allocate buffer for current entry
+        uint32_t ent_lba = curdir->lba.le;
+        size_t ent_size = curdir->datalength.le;
+        size_t ent_num_sectors = (ent_size + ENGINE::CONST::SECTOR_SIZE - 1) / ENGINE::CONST::SECTOR_SIZE;
+
+        ENGINE::TEMPLATES::UniquePtr<uint8_t[]> ent_buffer(new uint8_t[ent_num_sectors * ENGINE::CONST::SECTOR_SIZE]);
+        if (!drive->read(ent_lba, ent_buffer.get(), ent_num_sectors))
+            return false;
+
+        //find next path component
+        const char *next_component = strchr(path, '/');
+        size_t component_len = next_component ? (next_component - path) : strlen(path);
+        if (component_len == 0) {
+            result = *curdir;
+            return true;
+        }
+
+        uint8_t *ptr = ent_buffer.get();
+        uint8_t *end = ent_buffer.get() + ent_size;
+        while (ptr < end) {
+            if (ptr[0] == 0) {
+                ptr++;
+                continue;
+            }
+
+            auto entry = reinterpret_cast<ISO9660::Entry*>(ptr);
+            const char *name = entry->getName();
+            uint8_t namelen = entry->name_length;
+
+            //skip "." and ".."
+            if (namelen == 1 && (name[0] == '\0' || name[0] == '\1')) {
+                ptr += entry->length;
+                continue;
+            }
+
+            //check if current entry matches the entry
+            if (strncmp(path, name, namelen) == 0 && namelen == component_len) {
+                //if no more components, return entry
+                if (!next_component || !next_component[1]) {
+                    result = *entry;
+                    return true;
+                }
+
+                //recurse if it's a directory
+                if (entry->flag & ISO9660::FLAG_DIRECTORY) {
+                    return getEntry(drive, entry, next_component + 1, result);
+                }
+            }
+
+            ptr += entry->length;
+        }
+
+        return false; //entry not found
+    }
+
+    //file
+    uint32_t ISOFile::read(void *output, uint32_t length) {
+        auto ptr    = uintptr_t(output);
+        auto offset = uint32_t(_offset);
+
+        // Do not read any data past the end of the file.
+        length = ENGINE::COMMON::min(length, size_t(_size) - offset);
+
+        for (auto remaining = length; remaining > 0;) {
+            auto sectorOffset = offset / ENGINE::CONST::SECTOR_SIZE;
+            auto ptrOffset    = offset % ENGINE::CONST::SECTOR_SIZE;
+
+            auto   lba    = _startLBA + sectorOffset;
+            auto   buffer = reinterpret_cast<void *>(ptr);
+            size_t readLength;
+
+            if (
+                !ptrOffset &&
+                (remaining >= ENGINE::CONST::SECTOR_SIZE) &&
+                ENGINE::COMMON::isBufferAligned(buffer)
+            ) {
+                // If the read offset is on a sector boundary, at least one sector's
+                // worth of data needs to be read and the pointer satisfies any DMA
+                // alignment requirements, read as many full sectors as possible
+                // directly into the output buffer.
+                auto numSectors = remaining / ENGINE::CONST::SECTOR_SIZE;
+                auto remainder  = remaining % ENGINE::CONST::SECTOR_SIZE;
+                readLength      = remaining - remainder;
+
+                if (!_drive->read(lba, buffer, numSectors))
+                    return 0;
+            } else {
+                // In all other cases, go through the sector cache one sector at
+                // a time and copy the requested data over. Reading ahead only
+                // pays off once the file is being walked sequentially.
+                readLength =
+                    ENGINE::COMMON::min(remaining, ENGINE::CONST::SECTOR_SIZE - ptrOffset);
+
+                bool sequential = (lba == _lastLBA) || (lba == _lastLBA + 1);
+                auto sector     = _cache->get(
+                    lba,
+                    sequential ? ENGINE::CONST::SECTOR_READAHEAD : 0,
+                    _startLBA + uint32_t((_size + ENGINE::CONST::SECTOR_SIZE - 1) / ENGINE::CONST::SECTOR_SIZE)
+                );
+                if (!sector)
+                    return 0;
+
+                _lastLBA = lba;
+                __builtin_memcpy(buffer, &sector[ptrOffset], readLength);
+            }
+
+            ptr       += readLength;
+            offset    += readLength;
+            remaining -= readLength;
+        }
+
+        _offset += length;
+        return length;
+    }
+
+    uint64_t ISOFile::seek(uint64_t offset) {
+        _offset = ENGINE::COMMON::min(offset, _size); 
+        
+        return _offset;
+    }
+
+ //   void ISOFile::close(void) {
+//
+ //   }
+
+    //sector cache
+    constexpr uint32_t INVALID_LBA = 0xffffffff;
+
+    void SectorCache::init(CDDrive *_drive, int numSectors) {
+        drive = _drive;
+        entries.reset(new Entry[numSectors]);
+        data.reset(new uint32_t[numSectors * (ENGINE::CONST::SECTOR_SIZE / 4)]);
+        numentries = numSectors;
+        invalidate();
+    }
+
+    void SectorCache::invalidate(void) {
+        for (int i = 0; i < numentries; i++) {
+            entries[i].lba     = INVALID_LBA;
+            entries[i].lastuse = 0;
+        }
+    }
+
+    int SectorCache::find(uint32_t lba) const {
+        for (int i = 0; i < numentries; i++)
+            if (entries[i].lba == lba)
+                return i;
+        return -1;
+    }
+
+    int SectorCache::findVictim(void) const {
+        int victim = 0;
+        for (int i = 1; i < numentries; i++)
+            if ((usecounter - entries[i].lastuse) > (usecounter - entries[victim].lastuse))
+                victim = i;
+        return victim;
+    }
+
+    const uint8_t *SectorCache::get(uint32_t lba, uint32_t readahead, uint32_t endLBA) {
+        int index = find(lba);
+        if (index >= 0) {
+            hits++;
+            entries[index].lastuse = ++usecounter;
+            return getData(index);
+        }
+
+        misses++;
+
+        // read the sector and as many of the following ones as asked for, up
+        // to the first one that's already cached
+        void *ptrs[ENGINE::CONST::SECTOR_CACHE_SIZE];
+        int   slots[ENGINE::CONST::SECTOR_CACHE_SIZE];
+        int   count = 0;
+        int   maxcount = ENGINE::COMMON::min(int(readahead) + 1, ENGINE::COMMON::min(numentries, ENGINE::CONST::SECTOR_CACHE_SIZE));
+
+        for (uint32_t next = lba; (count < maxcount) && (next < endLBA); next++, count++) {
+            if ((next != lba) && (find(next) >= 0))
+                break;
+
+            // claiming the slot right away keeps findVictim from handing it out twice
+            int victim = findVictim();
+            entries[victim].lba     = next;
+            entries[victim].lastuse = ++usecounter;
+            slots[count] = victim;
+            ptrs[count]  = getData(victim);
+        }
+
+        // the requested sector is the one about to be used
+        entries[slots[0]].lastuse = ++usecounter;
+
+        if (!drive->readSectors(lba, ptrs, count)) {
+            for (int i = 0; i < count; i++)
+                entries[slots[i]].lba = INVALID_LBA;
+            return nullptr;
+        }
+
+        readaheads += count - 1;
+        return getData(slots[0]);
+    }
+
+    ISOFileSystem::ISOFileSystem(CDDrive *_drive) : drive(_drive), scheduler(_drive) {
+        cache.init(drive, ENGINE::CONST::SECTOR_CACHE_SIZE);
+
+        //pvd sector
+        drive->read(16, &pvd, sizeof(pvd) / ENGINE::CONST::SECTOR_SIZE); 
+        //assert(pvd.magic == "CD001"_c); //todo _c operator
+
+        rootdir = reinterpret_cast<const ISO9660::Entry*>(&pvd.rootdir);
+    }
+
+    File *ISOFileSystem::findFile(const char *path) {
+        char fixedPath[256];
+
+        strcpy(fixedPath, path);
+        // append ";1" for iso9660
+        strcat(fixedPath, ";1");
+
+        ISO9660::Entry entry;
+        if (!getEntry(drive, this->rootdir, fixedPath, entry))
+            return nullptr;
+
+        ISOFile *file = new ISOFile();
+        file->_startLBA = entry.lba.le;
+        file->_size     = entry.datalength.le;
+        file->_offset   = 0;
+        file->_lastLBA  = file->_startLBA - 1; //reading from the start counts as sequential
+        file->_drive    = drive;
+        file->_cache    = &cache;
+        
+        return file;
+    }
+
+    //async reads
+    AsyncReadHandle ISOFileSystem::queueRead(File *file, void *buffer, uint32_t length, uint64_t offset, AsyncReadCallback callback, void *arg) {
+        auto read = allocRead(file, buffer, length, offset, callback, arg);
+        if (!read)
+            return 0;
+
+        auto isofile = static_cast<ISOFile *>(file);
+        uint64_t end = (offset + length < isofile->_size) ? (offset + length) : isofile->_size;
+
+        // the dma needs the start of a sector and an aligned buffer
+        uint32_t sectors = 0;
+        if (
+            (offset < end) &&
+            !(offset % ENGINE::CONST::SECTOR_SIZE) &&
+            ENGINE::COMMON::isBufferAligned(buffer)
+        )
+            sectors = uint32_t((end - offset) / ENGINE::CONST::SECTOR_SIZE);
+
+        if (!sectors) {
+            // too small or misaligned to bother, read it right away
+            read->length = readAt(file, buffer, length, offset);
+            read->done   = true;
+            return read->handle;
+        }
+
+        auto &request = requests[read - asyncreads];
+        request.lba        = isofile->_startLBA + uint32_t(offset / ENGINE::CONST::SECTOR_SIZE);
+        request.numSectors = sectors;
+        request.output     = buffer;
+        request.priority   = CD_PRIORITY_NORMAL;
+        scheduler.submit(&request);
+        return read->handle;
+    }
+
+    void ISOFileSystem::update(void) {
+        scheduler.update();
+
+        for (int i = 0; i < ENGINE::CONST::FILE_ASYNC_READS; i++) {
+            auto &request = requests[i];
+            auto &read    = asyncreads[i];
+            if (!request.isDone())
+                continue;
+
+            uint32_t done = request.numSectors * ENGINE::CONST::SECTOR_SIZE;
+            if (request.state == CD_REQUEST_DONE) {
+                if (read.length > done)
+                    done += readAt(
+                        read.file,
+                        reinterpret_cast<uint8_t *>(read.buffer) + done,
+                        read.length - done,
+                        read.offset + done
+                    );
+                read.length = done;
+            } else {
+                read.length = 0;
+            }
+
+            read.done     = true;
+            request.state = CD_REQUEST_IDLE;
+        }
+
+        FileSystem::update();
+    }
+
+} //namespace ENGINE
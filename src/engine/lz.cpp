@@ -0,0 +1,110 @@
+#include "lz.hpp"
+
+namespace ENGINE {
+
+    // overlapping copies have to go forward a byte at a time: matches closer
+    // than their length repeat themselves and in place literals move down
+    // onto themselves. anything else can use memcpy's word loop
+    static inline void copy(uint8_t *dst, const uint8_t *src, uint32_t n) {
+        if ((dst + n <= src) || (src + n <= dst)) {
+            __builtin_memcpy(dst, src, n);
+            return;
+        }
+        while (n--)
+            *dst++ = *src++;
+    }
+
+    // false if end came first, the length so far is left in n
+    static inline bool readLength(const uint8_t *&p, const uint8_t *end, uint32_t &n) {
+        if (n != 15)
+            return true;
+
+        uint8_t b;
+        do {
+            if (p >= end)
+                return false;
+            b  = *p++;
+            n += b;
+        } while (b == 255);
+        return true;
+    }
+
+    void LZDecoder::init(void *_output, uint32_t _length, const void *_input, uint32_t _inputlength) {
+        output      = reinterpret_cast<uint8_t *>(_output);
+        input       = reinterpret_cast<const uint8_t *>(_input);
+        length      = _length;
+        inputlength = _inputlength;
+        outpos      = 0;
+        inpos       = 0;
+    }
+
+    LZResult LZDecoder::decode(uint32_t available) {
+        if (available > inputlength)
+            available = inputlength;
+
+        const uint8_t *ip  = input + inpos;
+        const uint8_t *end = input + available;
+        const uint8_t *last = input + inputlength;
+        uint8_t *op   = output + outpos;
+        uint8_t *oend = output + length;
+        LZResult result = LZ_MORE;
+
+        while (ip < end) {
+            // the whole header is read before anything is written, when
+            // unpacking in place the output may reach it afterwards
+            const uint8_t *p = ip;
+            uint8_t token = *p++;
+
+            uint32_t literals = token >> 4;
+            if (!readLength(p, end, literals) || (uint32_t(end - p) < literals))
+                break;
+            const uint8_t *source = p;
+            p += literals;
+
+            uint32_t offset = 0, match = 0;
+            if (p < last) {
+                if ((end - p) < 2)
+                    break;
+                offset = p[0] | (p[1] << 8);
+                p += 2;
+                match = token & 15;
+                if (!readLength(p, end, match))
+                    break;
+                match += 4;
+            }
+
+            if (uint32_t(oend - op) < (literals + match)) {
+                result = LZ_ERROR;
+                break;
+            }
+
+            copy(op, source, literals);
+            op += literals;
+            ip  = p;
+
+            if (!offset) {
+                // literals only, has to be the end
+                result = ((p == last) && (op == oend)) ? LZ_DONE : LZ_ERROR;
+                break;
+            }
+            if (offset > uint32_t(op - output)) {
+                result = LZ_ERROR;
+                break;
+            }
+
+            copy(op, op - offset, match);
+            op += match;
+        }
+
+        inpos  = ip - input;
+        outpos = op - output;
+        return result;
+    }
+
+    bool LZDecoder::decompress(void *output, uint32_t length, const void *input, uint32_t inputlength) {
+        LZDecoder decoder;
+        decoder.init(output, length, input, inputlength);
+        return decoder.decode(inputlength) == LZ_DONE;
+    }
+
+} //namespace ENGINE
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace ENGINE {
+
+    // lz4 block format as written by tools/compressLZ.py: sequences of a
+    // token (literal count in the top nibble, match length - 4 in the bottom
+    // one), the literals, and a 16 bit offset back into the output, the last
+    // sequence being literals only. all byte aligned, unpacking is loads,
+    // stores and a few compares per sequence
+    enum LZResult : uint8_t {
+        LZ_MORE,  // every whole sequence in the input so far is unpacked
+        LZ_DONE,
+        LZ_ERROR  // corrupt, or it doesn't unpack to exactly length bytes
+    };
+
+    class LZDecoder {
+    public:
+        LZDecoder(void) : output(nullptr), input(nullptr), length(0), inputlength(0), outpos(0), inpos(0) {}
+
+        // input may be inside output (unpacking in place) if it starts at
+        // inPlaceOffset(), both must stay put until decode() is done
+        void init(void *output, uint32_t length, const void *input, uint32_t inputlength);
+        // unpacks what it can from the first available bytes of input, call
+        // again as more of it arrives. a sequence is only started once all of
+        // its header is there, so nothing is ever unpacked twice
+        LZResult decode(uint32_t available);
+        uint32_t getOutputPosition(void) const {return outpos;}
+
+        // all at once, false if the data is bad
+        static bool decompress(void *output, uint32_t length, const void *input, uint32_t inputlength);
+        // where packed data with the given margin (from the bundle) has to
+        // start in a buffer so it can be unpacked over itself, word aligned
+        // for the dma. the buffer has to be that plus inputlength long
+        static uint32_t inPlaceOffset(uint32_t length, uint32_t inputlength, uint32_t margin) {
+            uint32_t end = length + margin;
+            return (end > inputlength) ? ((end - inputlength + 3) & ~3u) : 0;
+        }
+    private:
+        uint8_t *output;
+        const uint8_t *input;
+        uint32_t length, inputlength;
+        uint32_t outpos, inpos; // where the next sequence goes / starts
+    };
+
+} //namespace ENGINE
@@ -0,0 +1,36 @@
+#include "model.hpp"
+
+namespace ENGINE {
+
+    // error * scale / unit is how many pixels a lod is off by, the errors
+    // only grow from one lod to the next
+    static uint32_t selectLOD(const ModelLOD *lods, uint32_t numlods, uint32_t scale, uint32_t unit, uint32_t current) {
+        if (!unit)
+            return 0;
+
+        uint64_t limit = uint64_t(CONST::MODEL_LOD_MAX_ERROR) * unit * 100;
+        uint32_t lod = 0;
+
+        for (uint32_t i = 1; i < numlods; i++) {
+            uint64_t projected = uint64_t(lods[i].error) * scale;
+            projected *= (i > current) ? (100 + CONST::MODEL_LOD_HYSTERESIS) : 100;
+            if (projected > limit)
+                break;
+            lod = i;
+        }
+
+        return lod;
+    }
+
+    uint32_t selectLODByDepth(const ModelLOD *lods, uint32_t numlods, int32_t z, int32_t h, uint32_t current) {
+        // at or behind the camera, nothing to save
+        if ((z <= 0) || (h <= 0))
+            return 0;
+        return selectLOD(lods, numlods, uint32_t(h), uint32_t(z), current);
+    }
+
+    uint32_t selectLODBySize(const ModelLOD *lods, uint32_t numlods, uint32_t radius, uint32_t pixels, uint32_t current) {
+        return selectLOD(lods, numlods, pixels, radius, current);
+    }
+
+} //namespace ENGINE
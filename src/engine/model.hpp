@@ -0,0 +1,53 @@
+#pragma once
+
+#include "constants.hpp"
+#include <stdint.h>
+
+namespace ENGINE {
+
+    // xmdl as written by tools/convertModel.py: the header, one ModelLOD per
+    // level of detail (finest first), the vertices, every lod's faces one
+    // after another, then the textures
+    struct ModelHeader {
+        uint32_t magic;
+        uint32_t numvertices, numfaces, numtex;
+        int32_t shift; // vertices are model units * 2^shift
+        uint32_t numlods;
+    };
+
+    struct ModelLOD {
+        uint32_t numvertices; // the lod only uses the first numvertices vertices
+        uint32_t firstface, numfaces;
+        uint32_t error; // how far its surface is from the full mesh, in vertex units
+    };
+
+    struct ModelVertex {
+        int16_t x, y, z, _padding;
+    };
+
+    struct ModelFace {
+        int16_t indices[4]; // z shaped like gpu quads, -1 last on triangles
+        uint32_t color;
+        uint8_t u[4], v[4];
+        int32_t texid;
+    };
+
+    static_assert(sizeof(ModelHeader) == 24, "ModelHeader must match convertModel.py");
+    static_assert(sizeof(ModelLOD) == 16, "ModelLOD must match convertModel.py");
+    static_assert(sizeof(ModelFace) == 24, "ModelFace must match convertModel.py");
+
+    static constexpr uint32_t MODEL_MAGIC = 'X' | ('M' << 8) | ('D' << 16) | ('L' << 24);
+
+    // both pick the coarsest lod whose error is at most MODEL_LOD_MAX_ERROR
+    // pixels on screen. current is the lod drawn last time, dropping below it
+    // needs MODEL_LOD_HYSTERESIS % of slack so a car right at the boundary
+    // doesn't flicker between two lods
+
+    // z is the view depth in the model's vertex units (the gte's sz when it's
+    // drawn unscaled), h the projection distance (the gte's h)
+    uint32_t selectLODByDepth(const ModelLOD *lods, uint32_t numlods, int32_t z, int32_t h, uint32_t current = 0);
+    // radius of the model's bounds in vertex units and how many pixels that
+    // covers on screen
+    uint32_t selectLODBySize(const ModelLOD *lods, uint32_t numlods, uint32_t radius, uint32_t pixels, uint32_t current = 0);
+
+} //namespace ENGINE
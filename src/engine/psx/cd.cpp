@@ -1,13 +1,24 @@
 #include "cd.hpp"
+#include "../common.hpp"
+#include "../timer.hpp"
 #include <ps1/registers.h>
 #include <ps1/system.h>
 #include <ps1/cdrom.h>
+#include <ps1/cop0.h>
 #include <assert.h>
-#include <stdio.h> //puts
+#include <stdio.h> //puts, printf
 
 namespace ENGINE::PSX {
     TEMPLATES::ServiceLocator<CDRom> g_CDInstance;
 
+    // audio sectors matching the filter go straight to the spu, everything
+    // else is sent to us whole so the subheader can be checked
+    constexpr uint8_t XA_MODE = 0
+        | CDROM_MODE_XA_ADPCM
+        | CDROM_MODE_XA_FILTER
+        | CDROM_MODE_SIZE_2340
+        | CDROM_MODE_SPEED_2X;
+
     CDRom &CDRom::instance(void) {
         BIU_DEV5_CTRL = 0x00020943; // Configure bus
         DMA_DPCR |= DMA_DPCR_CH_ENABLE(DMA_CDROM); // Enable DMA
@@ -45,12 +56,37 @@ namespace ENGINE::PSX {
         instance->dataReady = false; 
         
         instance->readPtr = nullptr;
+        instance->readPtrList = nullptr;
+        instance->currentMode = 0xff;
+        instance->driveReading = false;
+        instance->nextLBA = 0;
+        instance->idleSectors = 0;
+        instance->seeks = 0;
+        instance->contiguousReads = 0;
+        instance->errorstats = {};
         instance->readSectorSize = 0;
         instance->readNumSectors = 0;
         
         instance->responselen = 0;
         instance->status = 0;
         instance->erroroccured = false;
+        instance->asyncstate = CD_ASYNC_IDLE;
+
+        instance->xaActive = false;
+        instance->pendingLocP = false;
+        instance->xaHead = 0;
+        instance->xaTail = 0;
+        instance->xaDropped = 0;
+        instance->xaCallback = nullptr;
+        instance->xaCallbackArg = nullptr;
+
+        instance->streamActive = false;
+        instance->streamPaused = false;
+        instance->streamNextLBA = 0;
+        instance->streamEndLBA = 0;
+        instance->streamHead = 0;
+        instance->streamTail = 0;
+        instance->streamOffset = 0;
 
         return *instance;
     };
@@ -80,48 +116,492 @@ namespace ENGINE::PSX {
         CDROM_COMMAND = cmd;
     }
 
+    void CDRom::claimDrive(void) {
+        // let a pending async read finish rather than pulling the drive from
+        // under it, its remaining sectors still go to its own buffer
+        if (asyncstate == CD_ASYNC_BUSY)
+            asyncstate = waitRead() ? CD_ASYNC_DONE : CD_ASYNC_FAILED;
+
+        // there's only one drive, a normal read takes it away from the stream
+        if (xaActive)
+            stopXA();
+        if (streamActive)
+            stopStream();
+    }
+
     bool CDRom::startRead(uint32_t lba, void *ptr, int numSectors, bool doubleSpeed, bool wait) {
+        claimDrive();
         readPtr = ptr;
-        readNumSectors = numSectors;
-        readSectorSize = SECTOR_SIZE; //for 90% of use cases 2048 is fine, the exception being xa files and whatnot
+        readPtrList = nullptr;
+        return beginRead(lba, numSectors, doubleSpeed, wait);
+    }
 
-        uint8_t mode = 0;
-        CDROMMSF msf;
+    bool CDRom::startReadScatter(uint32_t lba, void *const *ptrs, int numSectors, bool doubleSpeed, bool wait) {
+        claimDrive();
+        readPtr = nullptr;
+        readPtrList = ptrs;
+        return beginRead(lba, numSectors, doubleSpeed, wait);
+    }
+
+    bool CDRom::readAsync(uint32_t lba, void *ptr, int numSectors) {
+        return beginAsync(startRead(lba, ptr, numSectors, true, false), numSectors);
+    }
+
+    bool CDRom::readSectorsAsync(uint32_t lba, void *const *ptrs, int numSectors) {
+        return beginAsync(startReadScatter(lba, ptrs, numSectors, true, false), numSectors);
+    }
+
+    bool CDRom::beginAsync(bool ok, int numSectors) {
+        asyncstate     = ok ? CD_ASYNC_BUSY : CD_ASYNC_FAILED;
+        asyncRemaining = numSectors;
+        asyncProgress  = g_timerInstance.get()->getTicks();
+        return ok;
+    }
+
+    CDAsyncState CDRom::pollAsync(void) {
+        if (asyncstate != CD_ASYNC_BUSY)
+            return asyncstate;
+
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        if (takeError()) {
+            asyncstate = CD_ASYNC_FAILED;
+        } else if (readNumSectors <= 0) {
+            asyncstate = CD_ASYNC_DONE;
+        } else {
+            // same per sector timeout as waitRead()
+            auto timer = g_timerInstance.get();
+            uint64_t now = timer->getTicks();
+
+            if (readNumSectors != asyncRemaining) {
+                asyncRemaining = readNumSectors;
+                asyncProgress  = now;
+            } else if (timer->ticksToMS(now - asyncProgress) >= ENGINE::CONST::CD_SECTOR_TIMEOUT_MS) {
+                errorstats.timeouts++;
+                pauseDrive();
+                asyncstate = CD_ASYNC_FAILED;
+            }
+        }
+
+        return asyncstate;
+    }
 
-    //    if (sectorSize == 2340)
-    //      mode |= CDROM_MODE_SIZE_2340;
+    bool CDRom::beginRead(uint32_t lba, int numSectors, bool doubleSpeed, bool wait) {
+        readSectorSize = ENGINE::CONST::SECTOR_SIZE; //xa streams go through startXA instead
+
+        uint8_t mode = 0;
         if (doubleSpeed)
             mode |= CDROM_MODE_SPEED_2X;
 
+        // async reads can't be retried here, the caller sees the error flag
+        if (!wait)
+            return armRead(lba, numSectors, mode);
+
+        int done = 0;
+        for (int attempt = 0;; attempt++) {
+            if (attempt) {
+                if (attempt > ENGINE::CONST::CD_READ_RETRIES) {
+                    errorstats.failures++;
+                    printf("cd read of lba %u failed (%u errors, %u timeouts so far)\n", lba + uint32_t(done), errorstats.errors, errorstats.timeouts);
+                    return false;
+                }
+
+                errorstats.retries++;
+                // marginal sectors often read fine at 1x, and as a last
+                // resort the drive gets reset in case it's stuck
+                mode &= ~CDROM_MODE_SPEED_2X;
+                if (attempt == ENGINE::CONST::CD_READ_RETRIES)
+                    resetDrive();
+            }
+
+            int count = numSectors - done;
+            if (armRead(lba + done, count, mode) && waitRead())
+                return true;
+
+            // sectors that already made it stay, the retry picks up after them
+            done += count - ENGINE::COMMON::max(readNumSectors, 0);
+            pauseDrive();
+        }
+    }
+
+    bool CDRom::armRead(uint32_t lba, int numSectors, uint8_t mode) {
+        // if the drive is still reading right after the last request, and
+        // that's exactly where this one starts, just start keeping sectors
+        // again. the check has to be atomic with the irq moving nextLBA
+        uint32_t irqstate = cop0_disableInterrupts();
+        bool contiguous = driveReading && (mode == currentMode) && (lba == nextLBA);
+        if (contiguous) {
+            idleSectors = 0;
+            readNumSectors = numSectors;
+        }
+        if (irqstate)
+            cop0_enableInterrupts();
+
+        if (contiguous) {
+            contiguousReads++;
+            return true;
+        }
+
+        CDROMMSF msf;
         cdrom_convertLBAToMSF(&msf, lba);
+
+        pauseDrive();
+        readNumSectors = numSectors; //the irq ignores data until driveReading is set
+        if (!setMode(mode))
+            return false;
+        issueCMD(CDROM_CMD_SETLOC, reinterpret_cast<const uint8_t *>(&msf), sizeof(msf));
+        if (!waitAcknowledge())
+            return false;
+
+        // armed before the read starts, data only shows up after the seek
+        nextLBA = lba;
+        idleSectors = 0;
+        driveReading = true;
+        __atomic_signal_fence(__ATOMIC_RELEASE);
+
+        issueCMD(CDROM_CMD_READ_N, nullptr, 0);
+        seeks++;
+        return waitAcknowledge();
+    }
+
+    bool CDRom::waitRead(void) {
+        auto timer = g_timerInstance.get();
+        uint64_t lastprogress = timer->getTicks();
+        int lastremaining = readNumSectors;
+
+        while (true) {
+            if (takeError()) //read error
+                return false;
+
+            __atomic_signal_fence(__ATOMIC_ACQUIRE);
+
+            int remaining = readNumSectors;
+            if (remaining <= 0)
+                return true;
+
+            // the timeout is per sector, so long reads don't need a longer one
+            uint64_t now = timer->getTicks();
+            if (remaining != lastremaining) {
+                lastremaining = remaining;
+                lastprogress = now;
+            } else if (timer->ticksToMS(now - lastprogress) >= ENGINE::CONST::CD_SECTOR_TIMEOUT_MS) {
+                errorstats.timeouts++;
+                return false;
+            }
+        }
+    }
+
+    bool CDRom::waitAcknowledge(void) {
+        auto timer = g_timerInstance.get();
+        uint64_t start = timer->getTicks();
+
+        while (waitingForAcknowledge && waitingForError) {
+            if (timer->ticksToMS(timer->getTicks() - start) >= ENGINE::CONST::CD_ACK_TIMEOUT_MS) {
+                errorstats.timeouts++;
+                return false;
+            }
+        }
+
+        return !takeError();
+    }
+
+    bool CDRom::waitDataReady(void) {
+        auto timer = g_timerInstance.get();
+        uint64_t start = timer->getTicks();
+
+        while (waitingForDataReady && waitingForError) {
+            if (timer->ticksToMS(timer->getTicks() - start) >= ENGINE::CONST::CD_SECTOR_TIMEOUT_MS) {
+                errorstats.timeouts++;
+                return false;
+            }
+        }
+
+        return !takeError();
+    }
+
+    bool CDRom::waitComplete(void) {
+        auto timer = g_timerInstance.get();
+        uint64_t start = timer->getTicks();
+
+        while (waitingForComplete && waitingForError) {
+            if (timer->ticksToMS(timer->getTicks() - start) >= ENGINE::CONST::CD_RESET_TIMEOUT_MS) {
+                errorstats.timeouts++;
+                return false;
+            }
+        }
+
+        return !takeError();
+    }
+
+    bool CDRom::takeError(void) {
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        if (!erroroccured)
+            return false;
+
+        erroroccured = false;
+        errorstats.errors++;
+        __atomic_signal_fence(__ATOMIC_RELEASE);
+        return true;
+    }
+
+    void CDRom::resetDrive(void) {
+        errorstats.resets++;
+        driveReading = false;
+        readNumSectors = 0;
+        currentMode = 0xff; //init puts the drive back into its default mode
+
+        issueCMD(CDROM_CMD_INIT, nullptr, 0);
+        waitAcknowledge();
+
+        // the second response comes once the motor is back up to speed
+        waitComplete();
+        erroroccured = false;
+    }
+
+    bool CDRom::setMode(uint8_t mode) {
+        if (mode == currentMode)
+            return true;
+
         issueCMD(CDROM_CMD_SETMODE, &mode, sizeof(mode));
+        if (!waitAcknowledge()) {
+            currentMode = 0xff;
+            return false;
+        }
+
+        currentMode = mode;
+        return true;
+    }
+
+    void CDRom::pauseDrive(void) {
+        if (!driveReading)
+            return;
+
+        driveReading = false;
+        readNumSectors = 0;
+        issueCMD(CDROM_CMD_PAUSE, nullptr, 0);
         waitAcknowledge();
+    }
+
+    bool CDRom::startXA(uint32_t lba, uint32_t numSectors, uint8_t file, uint8_t channel, bool loop) {
+        if (streamActive)
+            stopStream();
+        pauseDrive();
+
+        xaStartLBA = lba;
+        xaEndLBA   = lba + numSectors;
+        xaFile     = file;
+        xaChannel  = channel;
+        xaLoop     = loop;
+        xaHead     = 0;
+        xaTail     = 0;
+        xaDropped  = 0;
+
+        uint8_t filter[2] = {file, channel};
+        issueCMD(CDROM_CMD_SETFILTER, filter, sizeof(filter));
+        waitAcknowledge();
+        setMode(XA_MODE);
+
+        xaActive = true;
+        return seekXA(lba);
+    }
+
+    bool CDRom::seekXA(uint32_t lba) {
+        CDROMMSF msf;
+        cdrom_convertLBAToMSF(&msf, lba);
+
+        xaPosition = lba;
+        pendingLocP = false;
+
         issueCMD(CDROM_CMD_SETLOC, reinterpret_cast<const uint8_t *>(&msf), sizeof(msf));
+        if (!waitAcknowledge())
+            return false;
+        // read_s doesn't stop to retry on errors, a glitch beats a gap in the music
+        issueCMD(CDROM_CMD_READ_S, nullptr, 0);
+        return waitAcknowledge();
+    }
+
+    void CDRom::setXAChannel(uint8_t channel) {
+        if (!xaActive || (channel == xaChannel))
+            return;
+
+        xaChannel = channel;
+        uint8_t filter[2] = {xaFile, channel};
+        issueCMD(CDROM_CMD_SETFILTER, filter, sizeof(filter));
         waitAcknowledge();
-        issueCMD(CDROM_CMD_READ_N, nullptr, 0);
+    }
+
+    void CDRom::stopXA(void) {
+        if (!xaActive)
+            return;
+
+        xaActive = false;
+        pendingLocP = false; //its answer may never come now
+        issueCMD(CDROM_CMD_PAUSE, nullptr, 0);
         waitAcknowledge();
+    }
+
+    void CDRom::updateXA(void) {
+        if (!xaActive)
+            return;
 
-        assert(waitingForDataReady);
+        if (xaCallback) {
+            for (auto sector = peekXAData(); sector; sector = peekXAData()) {
+                xaCallback(xaCallbackArg, sector);
+                popXAData();
+            }
+        }
 
-        if (wait) {
-            while (true) {
-                __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        // audio sectors never raise an irq, so the only way to know where
+        // the drive is, is asking it. the answer arrives in irqAcknowledge
+        // and is used next frame
+        if (xaPosition + 1 >= xaEndLBA) {
+            if (xaLoop)
+                seekXA(xaStartLBA);
+            else
+                stopXA();
+            return;
+        }
 
-                if (erroroccured) { //read error
-                    erroroccured = false;
-                    readNumSectors = 0;
-                    __atomic_signal_fence(__ATOMIC_RELEASE);
-                    return false;
-                }
+        if (!pendingLocP && !(CDROM_HSTS & CDROM_HSTS_BUSYSTS)) {
+            pendingLocP = true;
+            issueCMD(CDROM_CMD_GETLOC_P, nullptr, 0);
+        }
+    }
 
-                if (readNumSectors <= 0)
-                    return true;
+    const XASector *CDRom::peekXAData(void) {
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        if (xaHead == xaTail)
+            return nullptr;
+        return &xaSectors[xaTail % ENGINE::CONST::XA_DATA_SLOTS];
+    }
 
-                // todo should probably add a timeout check here too, in case the drive takes too long without returning any data
-                
-            }
+    void CDRom::popXAData(void) {
+        if (xaHead != xaTail)
+            xaTail = xaTail + 1;
+        __atomic_signal_fence(__ATOMIC_RELEASE);
+    }
+
+    bool CDRom::startStream(uint32_t lba, uint32_t numSectors, bool doubleSpeed) {
+        if (xaActive)
+            stopXA();
+        if (streamActive)
+            stopStream();
+        pauseDrive();
+
+        if (!streamBuffer)
+            streamBuffer.reset(new uint32_t[ENGINE::CONST::STREAM_SECTORS * ENGINE::CONST::SECTOR_SIZE / 4]);
+
+        streamNextLBA     = lba;
+        streamEndLBA      = lba + numSectors;
+        streamHead        = 0;
+        streamTail        = 0;
+        streamOffset      = 0;
+        streamDoubleSpeed = doubleSpeed;
+
+        setMode(doubleSpeed ? CDROM_MODE_SPEED_2X : 0);
+
+        streamActive = true;
+        return resumeStream();
+    }
+
+    bool CDRom::resumeStream(void) {
+        CDROMMSF msf;
+        cdrom_convertLBAToMSF(&msf, streamNextLBA);
+
+        // sectors showing up before the read is acknowledged are leftovers
+        // from before the pause, they're dropped and read again
+        streamPaused = true;
+        issueCMD(CDROM_CMD_SETLOC, reinterpret_cast<const uint8_t *>(&msf), sizeof(msf));
+        bool ok = waitAcknowledge();
+        if (ok) {
+            issueCMD(CDROM_CMD_READ_N, nullptr, 0);
+            ok = waitAcknowledge();
         }
-        return true;
+        streamPaused = false;
+        __atomic_signal_fence(__ATOMIC_RELEASE);
+
+        return ok;
+    }
+
+    void CDRom::stopStream(void) {
+        if (!streamActive)
+            return;
+
+        streamActive = false;
+        if (!streamPaused) {
+            issueCMD(CDROM_CMD_PAUSE, nullptr, 0);
+            waitAcknowledge();
+        }
+        streamPaused = false;
+    }
+
+    const uint8_t *CDRom::peekStreamSector(void) {
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        if (streamHead == streamTail)
+            return nullptr;
+
+        auto slot = streamTail % ENGINE::CONST::STREAM_SECTORS;
+        return reinterpret_cast<const uint8_t *>(&streamBuffer[slot * ENGINE::CONST::SECTOR_SIZE / 4]);
+    }
+
+    void CDRom::popStreamSector(void) {
+        if (streamHead == streamTail)
+            return;
+
+        streamTail   = streamTail + 1;
+        streamOffset = 0;
+        __atomic_signal_fence(__ATOMIC_RELEASE);
+
+        // restart the drive once there's a decent amount of room again, not
+        // on every free slot, as each restart costs a seek
+        uint32_t free = ENGINE::CONST::STREAM_SECTORS - (streamHead - streamTail);
+        if (streamActive && streamPaused && !isStreamDone() && (free >= ENGINE::CONST::STREAM_RESUME))
+            resumeStream();
+    }
+
+    uint32_t CDRom::readStream(void *output, uint32_t length) {
+        auto ptr  = reinterpret_cast<uint8_t *>(output);
+        uint32_t copied = 0;
+
+        while (copied < length) {
+            auto sector = peekStreamSector();
+            if (!sector)
+                break;
+
+            uint32_t chunk = ENGINE::COMMON::min(length - copied, ENGINE::CONST::SECTOR_SIZE - streamOffset);
+            __builtin_memcpy(&ptr[copied], &sector[streamOffset], chunk);
+
+            copied       += chunk;
+            streamOffset += chunk;
+            if (streamOffset >= ENGINE::CONST::SECTOR_SIZE)
+                popStreamSector();
+        }
+
+        return copied;
+    }
+
+    void CDRom::irqStreamData(void) {
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+
+        // in 2048 byte mode sectors carry no header, they're simply the next
+        // one after the last we stored. anything arriving while paused or
+        // full is dropped without advancing, so the resume reads it again
+        if (streamPaused || isStreamDone() || ((streamHead - streamTail) >= ENGINE::CONST::STREAM_SECTORS))
+            return;
+
+        auto slot = streamHead % ENGINE::CONST::STREAM_SECTORS;
+        DMA_MADR(DMA_CDROM) = reinterpret_cast<uint32_t>(&streamBuffer[slot * ENGINE::CONST::SECTOR_SIZE / 4]);
+        DMA_BCR(DMA_CDROM)  = ENGINE::CONST::SECTOR_SIZE / 4;
+        DMA_CHCR(DMA_CDROM) = DMA_CHCR_ENABLE | DMA_CHCR_TRIGGER;
+
+        streamHead    = streamHead + 1;
+        streamNextLBA = streamNextLBA + 1;
+
+        if (isStreamDone() || ((streamHead - streamTail) >= ENGINE::CONST::STREAM_SECTORS)) {
+            streamPaused = true;
+            issueCMD(CDROM_CMD_PAUSE, nullptr, 0);
+        }
+
+        __atomic_signal_fence(__ATOMIC_RELEASE);
     }
 
     //int1
@@ -129,16 +609,57 @@ namespace ENGINE::PSX {
     // This will read the data into readPtr.
     // It will also pause the CDROM drive.
     void CDRom::irqDataReady(void) {
+        if (xaActive) {
+            // can't pause the drive without stopping the music, so sectors
+            // the game didn't pick up in time are dropped
+            if ((xaHead - xaTail) >= ENGINE::CONST::XA_DATA_SLOTS) {
+                xaDropped++;
+                return;
+            }
+
+            auto sector = &xaSectors[xaHead % ENGINE::CONST::XA_DATA_SLOTS];
+            DMA_MADR(DMA_CDROM) = reinterpret_cast<uint32_t>(sector);
+            DMA_BCR(DMA_CDROM)  = ENGINE::CONST::XA_SECTOR_SIZE / 4;
+            DMA_CHCR(DMA_CDROM) = DMA_CHCR_ENABLE | DMA_CHCR_TRIGGER;
+
+            xaPosition = cdrom_convertMSFToLBA(&sector->msf);
+            xaHead = xaHead + 1;
+            __atomic_signal_fence(__ATOMIC_RELEASE);
+            return;
+        }
+        if (streamActive) {
+            irqStreamData();
+            return;
+        }
+
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        // leftovers from before a pause or seek
+        if (!driveReading)
+            return;
+
+        nextLBA = nextLBA + 1;
+
+        if (readNumSectors <= 0) {
+            // nobody asked for this one, the drive is only kept going for a
+            // bit in case the next read carries on from here
+            if (++idleSectors >= ENGINE::CONST::READ_IDLE_SECTORS) {
+                driveReading = false;
+                issueCMD(CDROM_CMD_PAUSE, nullptr, 0);
+            }
+            __atomic_signal_fence(__ATOMIC_RELEASE);
+            return;
+        }
+
+        if (readPtrList)
+            readPtr = *(readPtrList++);
+
         DMA_MADR(DMA_CDROM) = reinterpret_cast<uint32_t>(readPtr);
         DMA_BCR(DMA_CDROM)  = readSectorSize / 4;
         DMA_CHCR(DMA_CDROM) = DMA_CHCR_ENABLE | DMA_CHCR_TRIGGER;
 
-        __atomic_signal_fence(__ATOMIC_ACQUIRE);
         readPtr = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(readPtr) + readSectorSize);
-        if ((--readNumSectors) <= 0){
-            issueCMD(CDROM_CMD_PAUSE, nullptr, 0);
-        }
-            
+        readNumSectors = readNumSectors - 1;
+
         __atomic_signal_fence(__ATOMIC_RELEASE);
         waitingForDataReady = false;
     }
@@ -153,6 +674,14 @@ namespace ENGINE::PSX {
     //int3
     // This is usually just reading the status. It may be more than one parameter, however I don't handle that.
     void CDRom::irqAcknowledge(void) {
+        // getloc_p returns track, index, relative and absolute msf instead of the status
+        if (pendingLocP && (responselen >= 8)) {
+            xaPosition = cdrom_convertMSFToLBA(reinterpret_cast<const CDROMMSF *>(&response[5]));
+            pendingLocP = false;
+            waitingForAcknowledge = false;
+            return;
+        }
+
         status = response[0];
         waitingForAcknowledge = false;
     }
@@ -169,6 +698,8 @@ namespace ENGINE::PSX {
         puts("read error cdrom");
         waitingForError = false;
         erroroccured = true;
+        pendingLocP = false; //a getloc_p that failed, updateXA() asks again
+        driveReading = false; //position is unknown now, next read has to seek
     }
 
 } //namespace ENGINE::PSX 
\ No newline at end of file
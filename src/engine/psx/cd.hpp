@@ -1,20 +1,99 @@
 #pragma once
 
 #include "../templates.hpp"
+#include "../constants.hpp"
+#include "../cddrive.hpp"
+#include <ps1/cdrom.h>
 
 namespace ENGINE::PSX {
 
-    class CDRom {
+    // a sector as the drive sends it in 2340 byte mode
+    struct [[gnu::packed]] XASector {
+        CDROMMSF msf;
+        uint8_t mode;
+        CDROMXAHeader header, headercopy;
+        uint8_t data[ENGINE::CONST::SECTOR_SIZE];
+        uint8_t edc[4], ecc[276];
+    };
+    static_assert(sizeof(XASector) == ENGINE::CONST::XA_SECTOR_SIZE, "XASector must be exactly 2340 bytes");
+
+    struct CDErrorStats {
+        uint32_t errors;   // error irqs from the drive
+        uint32_t timeouts; // commands or sectors that never came
+        uint32_t retries;
+        uint32_t resets;
+        uint32_t failures; // reads given up on after every retry
+    };
+
+    // gets the data sectors of an xa stream, from updateXA()
+    using XADataCallback = void (*)(void *arg, const XASector *sector);
+
+    class CDRom : public ENGINE::CDDrive {
     public:
         void issueCMD(uint8_t cmd, const uint8_t *arg, int argLength);
         bool startRead(uint32_t lba, void *ptr, int numSectors, bool doubleSpeed, bool wait);
+        // same as startRead, but sector n goes to ptrs[n] (ptrs must stay valid until done)
+        bool startReadScatter(uint32_t lba, void *const *ptrs, int numSectors, bool doubleSpeed, bool wait);
+
+        // CDDrive
+        bool read(uint32_t lba, void *ptr, int numSectors) {
+            return startRead(lba, ptr, numSectors, true, true);
+        }
+        bool readSectors(uint32_t lba, void *const *ptrs, int numSectors) {
+            return startReadScatter(lba, ptrs, numSectors, true, true);
+        }
+        uint32_t getHeadLBA(void) const {return nextLBA;}
+        bool readAsync(uint32_t lba, void *ptr, int numSectors);
+        bool readSectorsAsync(uint32_t lba, void *const *ptrs, int numSectors);
+        CDAsyncState pollAsync(void);
+
+        // streams an interleaved xa file, the drive decodes and plays the
+        // audio sectors of file/channel on its own (no cpu or spu ram used)
+        // while data sectors are queued for peekXAData()
+        bool startXA(uint32_t lba, uint32_t numSectors, uint8_t file, uint8_t channel, bool loop);
+        // switches music without seeking, channel must be in the same file
+        void setXAChannel(uint8_t channel);
+        void stopXA(void);
+        // call once per frame while streaming, handles looping/stopping at the end
+        void updateXA(void);
+        bool isXAPlaying(void) const {return xaActive;}
+
+        // data sectors received while streaming go to callback once a frame
+        // from updateXA(). without one they're left for peekXAData()
+        void setXADataCallback(XADataCallback callback, void *arg) {
+            xaCallback = callback;
+            xaCallbackArg = arg;
+        }
+        // oldest data sector received while streaming, or nullptr
+        const XASector *peekXAData(void);
+        void popXAData(void);
+        uint32_t getDroppedXASectors(void) const {return xaDropped;}
+
+        // keeps the drive reading continuously into a sector ring instead of
+        // seeking for every read. the drive is paused when the ring fills up
+        // and picks up where it left off once the consumer catches up
+        bool startStream(uint32_t lba, uint32_t numSectors, bool doubleSpeed);
+        void stopStream(void);
+        // copies out whatever is buffered (up to length), never waits
+        uint32_t readStream(void *output, uint32_t length);
+        // zero copy access, one whole sector at a time
+        const uint8_t *peekStreamSector(void);
+        void popStreamSector(void);
+        uint32_t getStreamBuffered(void) const {return streamHead - streamTail;}
+        // every sector has been read by the drive (not necessarily consumed)
+        bool isStreamDone(void) const {return streamNextLBA >= streamEndLBA;}
+
+        // reads that had to seek vs. ones that picked up where the last ended
+        uint32_t getSeeks(void) const {return seeks;}
+        uint32_t getContiguousReads(void) const {return contiguousReads;}
+        const CDErrorStats &getErrorStats(void) const {return errorstats;}
 
         void irqDataReady(void);
         void irqComplete(void);
         void irqAcknowledge(void);
         void irqDataEnd(void);
         void irqError(void);
-        
+
         uint8_t response[16];
         uint8_t responselen;
 
@@ -24,29 +103,72 @@ namespace ENGINE::PSX {
         volatile bool waitingForDataReady, waitingForComplete, waitingForAcknowledge, waitingForDataEnd, waitingForError;
         bool dataReady;
         void *readPtr;
+        void *const *readPtrList;
         int readSectorSize;
-        int readNumSectors;
+        volatile int readNumSectors;
+
+        // what the drive is doing, so reads can skip commands it doesn't need
+        uint8_t currentMode; // 0xff until the first setmode
+        volatile bool driveReading;
+        volatile uint32_t nextLBA; // sector the drive delivers next while reading
+        volatile uint32_t idleSectors;
+        uint32_t seeks, contiguousReads;
+        CDErrorStats errorstats;
         uint8_t status;
         bool erroroccured;
-        
-        void waitDataReady(void) {
-            while(waitingForDataReady && waitingForError)
-                __asm__ volatile("");
-        }
+        CDAsyncState asyncstate;
+        int asyncRemaining;     // sectors left at the last poll, for the timeout
+        uint64_t asyncProgress; // ticks when that last changed
 
-        void waitComplete(void){
-            while(waitingForComplete)
-                __asm__ volatile("");
-        }
+        // xa streaming state, the sector ring is filled by the irq
+        bool xaActive, xaLoop;
+        uint8_t xaFile, xaChannel;
+        uint32_t xaStartLBA, xaEndLBA;
+        volatile uint32_t xaPosition; // last lba the drive reported
+        volatile bool pendingLocP;
+        volatile uint32_t xaHead, xaTail;
+        uint32_t xaDropped;
+        XADataCallback xaCallback;
+        void *xaCallbackArg;
+        XASector xaSectors[ENGINE::CONST::XA_DATA_SLOTS] __attribute__((aligned(4)));
 
-        void waitAcknowledge(void){
-            while(waitingForAcknowledge && waitingForError)
-                __asm__ volatile("");
+        bool beginAsync(bool ok, int numSectors);
+        // waits out an async read and stops xa/streams, before the read
+        // pointers are touched since the irq still writes through them
+        void claimDrive(void);
+        // waiting reads are retried (at 1x after the first failure) and
+        // the drive is reset before the last attempt
+        bool beginRead(uint32_t lba, int numSectors, bool doubleSpeed, bool wait);
+        bool armRead(uint32_t lba, int numSectors, uint8_t mode);
+        bool waitRead(void);
+        bool setMode(uint8_t mode);
+        void pauseDrive(void);
+        void resetDrive(void);
+        bool seekXA(uint32_t lba);
 
-        }
+        // continuous read state, head/nextlba are advanced by the irq
+        bool streamActive, streamDoubleSpeed;
+        volatile bool streamPaused;
+        volatile uint32_t streamNextLBA;
+        uint32_t streamEndLBA;
+        volatile uint32_t streamHead, streamTail;
+        uint32_t streamOffset; // bytes of the tail sector already consumed
+        TEMPLATES::UniquePtr<uint32_t[]> streamBuffer;
+
+        bool resumeStream(void);
+        void irqStreamData(void);
+
+        // false if the drive didn't answer within CD_ACK_TIMEOUT_MS or errored,
+        // an error is counted and cleared so it doesn't fail the next wait too
+        bool waitAcknowledge(void);
+        // same for a sector (CD_SECTOR_TIMEOUT_MS) and the second response
+        bool waitDataReady(void);
+        bool waitComplete(void);
+        // clears a pending error (counting it), true if there was one
+        bool takeError(void);
 
         CDRom() {};
     };
 
     extern TEMPLATES::ServiceLocator<CDRom> g_CDInstance;
-} //namespace ENGINE::PSX 
\ No newline at end of file
+} //namespace ENGINE::PSX
@@ -1,6 +1,7 @@
 #include "irq.hpp"
 
 #include <ps1/system.h>
+#include <ps1/registers.h>
 #include <ps1/cop0.h>
 #include <ps1/cdrom.h>
 
@@ -75,6 +76,9 @@ namespace ENGINE::PSX {
         if (acknowledgeInterrupt(IRQ_VSYNC)){
             reinterpret_cast<PSXRenderer *>(g_rendererInstance.get())->handleVSyncInterrupt();
         }
+        if (acknowledgeInterrupt(IRQ_GPU)){
+            reinterpret_cast<PSXRenderer *>(g_rendererInstance.get())->handleGPUInterrupt();
+        }
     }
 
     void initIRQ(void){
@@ -87,7 +91,8 @@ namespace ENGINE::PSX {
         IRQ_MASK = 0 | 
                 (1 << IRQ_TIMER2) | 
                 (1 << IRQ_CDROM) |
-                (1 << IRQ_VSYNC);
+                (1 << IRQ_VSYNC) |
+                (1 << IRQ_GPU);
         cop0_enableInterrupts();
     }
 
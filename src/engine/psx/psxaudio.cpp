@@ -0,0 +1,266 @@
+#include "../audio.hpp"
+#include "../common.hpp"
+#include <assert.h>
+#include <stdio.h> //printf
+#include <ps1/registers.h>
+
+namespace ENGINE::PSX {
+
+    // spu ram layout: 0x0000-0x0fff are the cd/voice capture buffers, then a
+    // silent looping block idle voices point to, everything after that is
+    // handed out by the allocator
+    constexpr uint32_t SPU_RAM_SIZE   = 0x80000;
+    constexpr uint32_t SPU_DUMMY_ADDR = 0x1000;
+    constexpr uint32_t SPU_HEAP_START = 0x1040;
+
+    // the spu dma transfers whole chunks, so allocations are rounded up to
+    // that to keep the tail of an upload from trashing the next sample
+    constexpr uint32_t SPU_CHUNK_SIZE = ENGINE::CONST::DMA_MAX_CHUNK_SIZE * 4;
+
+    constexpr uint16_t DEFAULT_ADSR1 = 0x00ff; //instant attack, max sustain
+    constexpr uint16_t DEFAULT_ADSR2 = 0x0000;
+
+    enum ADPCMFlag : uint8_t {
+        ADPCM_END        = 1 << 0,
+        ADPCM_REPEAT     = 1 << 1,
+        ADPCM_LOOP_START = 1 << 2
+    };
+
+    // one silent block that loops on itself, padded to a full dma chunk
+    alignas(4) static const uint8_t dummyBlock[SPU_CHUNK_SIZE] = {
+        0, ADPCM_END | ADPCM_REPEAT | ADPCM_LOOP_START
+    };
+
+    // the last partial chunk of an upload goes through here, so the dma
+    // doesn't read past the end of the caller's buffer
+    alignas(4) static uint8_t tailChunk[SPU_CHUNK_SIZE];
+
+    static void waitForStatus(uint16_t mask, uint16_t value) {
+        while ((SPU_STAT & mask) != value)
+            __asm__ volatile("");
+    }
+
+    static void waitForDMADone(void) {
+        while (DMA_CHCR(DMA_SPU) & DMA_CHCR_ENABLE)
+            __asm__ volatile("");
+    }
+
+    //allocator
+    void SPUAllocator::init(uint32_t start, uint32_t end) {
+        blocks[0].addr = start;
+        blocks[0].size = end - start;
+        blocks[0].used = false;
+        numblocks = 1;
+    }
+
+    uint32_t SPUAllocator::alloc(uint32_t size) {
+        size = (size + SPU_CHUNK_SIZE - 1) & ~(SPU_CHUNK_SIZE - 1);
+
+        for (int i = 0; i < numblocks; i++) {
+            auto &block = blocks[i];
+            if (block.used || (block.size < size))
+                continue;
+
+            // split off the rest of the block if there's room to track it
+            if ((block.size > size) && (numblocks < ENGINE::CONST::AUDIO_SPU_MAX_BLOCKS)) {
+                for (int j = numblocks; j > i + 1; j--)
+                    blocks[j] = blocks[j - 1];
+
+                blocks[i + 1].addr = block.addr + size;
+                blocks[i + 1].size = block.size - size;
+                blocks[i + 1].used = false;
+                block.size = size;
+                numblocks++;
+            }
+
+            block.used = true;
+            return block.addr;
+        }
+
+        return 0;
+    }
+
+    void SPUAllocator::free(uint32_t addr) {
+        int i;
+        for (i = 0; i < numblocks; i++)
+            if (blocks[i].addr == addr)
+                break;
+
+        assert(i < numblocks && blocks[i].used);
+        blocks[i].used = false;
+
+        // merge with the following and then the preceding block if free
+        for (int merge = ((i > 0) && !blocks[i - 1].used) ? i - 1 : i; merge + 1 < numblocks;) {
+            if (blocks[merge].used || blocks[merge + 1].used)
+                break;
+
+            blocks[merge].size += blocks[merge + 1].size;
+            for (int j = merge + 1; j < numblocks - 1; j++)
+                blocks[j] = blocks[j + 1];
+            numblocks--;
+        }
+    }
+
+    uint32_t SPUAllocator::getFree(void) const {
+        uint32_t total = 0;
+        for (int i = 0; i < numblocks; i++)
+            if (!blocks[i].used)
+                total += blocks[i].size;
+        return total;
+    }
+
+    //audio
+    PSXAudio::PSXAudio(void) {
+        DMA_DPCR |= DMA_DPCR_CH_ENABLE(DMA_SPU);
+
+        SPU_CTRL = 0;
+        waitForStatus(0x3f, 0);
+
+        SPU_MASTER_VOL_L = 0;
+        SPU_MASTER_VOL_R = 0;
+        SPU_REVERB_VOL_L = 0;
+        SPU_REVERB_VOL_R = 0;
+
+        SPU_FLAG_OFF1    = 0xffff;
+        SPU_FLAG_OFF2    = 0x00ff;
+        SPU_FLAG_FM1     = 0;
+        SPU_FLAG_FM2     = 0;
+        SPU_FLAG_NOISE1  = 0;
+        SPU_FLAG_NOISE2  = 0;
+        SPU_FLAG_REVERB1 = 0;
+        SPU_FLAG_REVERB2 = 0;
+
+        // cd audio goes through the spu, xa playback needs it enabled
+        SPU_CTRL = SPU_CTRL_CDDA | SPU_CTRL_UNMUTE | SPU_CTRL_ENABLE;
+        waitForStatus(0x3f, SPU_CTRL_CDDA);
+
+        SPU_DMA_CTRL = 4; //normal transfer mode
+
+        // park every voice on the silent block
+        upload(SPU_DUMMY_ADDR, dummyBlock, sizeof(dummyBlock));
+        for (int ch = 0; ch < ENGINE::CONST::AUDIO_NUM_VOICES; ch++) {
+            SPU_CH_VOL_L(ch)     = 0;
+            SPU_CH_VOL_R(ch)     = 0;
+            SPU_CH_FREQ(ch)      = 0x1000;
+            SPU_CH_ADDR(ch)      = SPU_DUMMY_ADDR / 8;
+            SPU_CH_ADSR1(ch)     = DEFAULT_ADSR1;
+            SPU_CH_ADSR2(ch)     = DEFAULT_ADSR2;
+        }
+
+        SPU_MASTER_VOL_L = ENGINE::CONST::AUDIO_MAX_VOLUME;
+        SPU_MASTER_VOL_R = ENGINE::CONST::AUDIO_MAX_VOLUME;
+        SPU_CDDA_VOL_L   = 0x7fff;
+        SPU_CDDA_VOL_R   = 0x7fff;
+
+        allocator.init(SPU_HEAP_START, SPU_RAM_SIZE);
+        keyonmask = keyoffmask = 0;
+    }
+
+    Sound *PSXAudio::loadSound(const void *data, uint32_t length, uint32_t samplerate) {
+        assert(ENGINE::COMMON::isBufferAligned(const_cast<void *>(data)));
+        assert(length >= 16 && !(length % 16));
+
+        uint32_t addr = allocator.alloc(length);
+        if (!addr) {
+            printf("out of spu ram (%u bytes wanted, %u free)\n", length, allocator.getFree());
+            return nullptr;
+        }
+
+        upload(addr, data, length);
+
+        auto sound        = new PSXSound();
+        auto lastflags    = reinterpret_cast<const uint8_t *>(data)[length - 16 + 1];
+        sound->addr       = addr;
+        sound->length     = length;
+        sound->samplerate = samplerate;
+        sound->basepitch  = basePitch(samplerate);
+        sound->loop       = (lastflags & (ADPCM_END | ADPCM_REPEAT)) == (ADPCM_END | ADPCM_REPEAT);
+
+        return sound;
+    }
+
+    void PSXAudio::freeSound(Sound *sound) {
+        if (!sound)
+            return;
+
+        stopSound(sound);
+        allocator.free(static_cast<PSXSound *>(sound)->addr);
+        delete sound;
+    }
+
+    void PSXAudio::update(void) {
+        // voices that hit an end block since the last frame are free again,
+        // unless we're about to restart them
+        uint32_t ended = SPU_FLAG_STATUS1 | (uint32_t(SPU_FLAG_STATUS2) << 16);
+        releaseChannels(ended & ~keyonmask);
+
+        if (keyoffmask) {
+            SPU_FLAG_OFF1 = keyoffmask & 0xffff;
+            SPU_FLAG_OFF2 = keyoffmask >> 16;
+        }
+        if (keyonmask) {
+            SPU_FLAG_ON1 = keyonmask & 0xffff;
+            SPU_FLAG_ON2 = keyonmask >> 16;
+        }
+
+        keyonmask = keyoffmask = 0;
+    }
+
+    void PSXAudio::upload(uint32_t addr, const void *data, uint32_t length) {
+        uint32_t whole = length / SPU_CHUNK_SIZE;
+        uint32_t tail  = length % SPU_CHUNK_SIZE;
+
+        if (whole)
+            uploadChunks(addr, data, whole);
+        if (tail) {
+            // allocations are whole chunks, the padding lands in our own block
+            __builtin_memcpy(tailChunk, reinterpret_cast<const uint8_t *>(data) + whole * SPU_CHUNK_SIZE, tail);
+            __builtin_memset(tailChunk + tail, 0, SPU_CHUNK_SIZE - tail);
+            uploadChunks(addr + whole * SPU_CHUNK_SIZE, tailChunk, 1);
+        }
+    }
+
+    void PSXAudio::uploadChunks(uint32_t addr, const void *data, uint32_t numchunks) {
+        waitForDMADone();
+
+        SPU_CTRL &= ~SPU_CTRL_XFER_BITMASK;
+        waitForStatus(SPU_CTRL_XFER_BITMASK, 0);
+
+        SPU_ADDR = addr / 8;
+        SPU_CTRL |= SPU_CTRL_XFER_DMA_WRITE;
+        waitForStatus(SPU_CTRL_XFER_BITMASK, SPU_CTRL_XFER_DMA_WRITE);
+
+        DMA_MADR(DMA_SPU) = reinterpret_cast<uint32_t>(data);
+        DMA_BCR (DMA_SPU) = ENGINE::CONST::DMA_MAX_CHUNK_SIZE | (numchunks << 16);
+        DMA_CHCR(DMA_SPU) = DMA_CHCR_WRITE | DMA_CHCR_MODE_SLICE | DMA_CHCR_ENABLE;
+
+        waitForDMADone();
+    }
+
+    void PSXAudio::startVoice(int ch, const Sound *sound, int16_t left, int16_t right, uint16_t pitch) {
+        SPU_CH_VOL_L(ch) = left;
+        SPU_CH_VOL_R(ch) = right;
+        SPU_CH_FREQ(ch)  = pitch;
+        SPU_CH_ADDR(ch)  = static_cast<const PSXSound *>(sound)->addr / 8;
+        SPU_CH_ADSR1(ch) = DEFAULT_ADSR1;
+        SPU_CH_ADSR2(ch) = DEFAULT_ADSR2;
+
+        keyonmask  |= 1 << ch;
+        keyoffmask &= ~(1 << ch);
+    }
+
+    void PSXAudio::stopVoice(int ch) {
+        keyoffmask |= 1 << ch;
+        keyonmask  &= ~(1 << ch);
+    }
+
+    void PSXAudio::setVoiceVolume(int ch, int16_t left, int16_t right) {
+        SPU_CH_VOL_L(ch) = left;
+        SPU_CH_VOL_R(ch) = right;
+    }
+
+    void PSXAudio::setVoicePitch(int ch, uint16_t pitch) {
+        SPU_CH_FREQ(ch) = pitch;
+    }
+
+} //namespace ENGINE::PSX
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "../renderer.hpp"
+#include "../timer.hpp"
 #include <assert.h>
 #include <stdio.h> //puts
 #include <ps1/registers.h>
@@ -32,8 +33,8 @@ namespace ENGINE::PSX {
 
 		// horizontal (256, 320, 368, 512, 640) and vertical (240-256, 480-512) resolutions to pick
 		GP1HorizontalRes hres;
-		scrw = ENGINE::COMMON::SCREEN_WIDTH;
-		scrh = ENGINE::COMMON::SCREEN_HEIGHT;
+		scrw = ENGINE::CONST::SCREEN_WIDTH;
+		scrh = ENGINE::CONST::SCREEN_HEIGHT;
 		
 		switch (scrw) {
 			case 256:
@@ -78,23 +79,33 @@ namespace ENGINE::PSX {
 		GPU_GP1 = gp1_dispBlank(false);
 		usingsecondframe = false;
 		framecounter = vsynccounter = fps = 0;
+		vblankcount = lastflip = 0;
+		framestart = gpustart = 0;
+		overbudget = underbudget = 0;
 		setClearCol(64,64,64);
+
+		GPU_GP1 = gp1_acknowledge();
 	}
 
 	void PSXRenderer::beginFrame(void) {
 		auto newchain = getCurrentChain();
+		framestart = g_timerInstance.get()->getTicks();
 
 		// determine where new framebuffer to draw to is in vram
 		int bufx = 0;
 		int bufy = usingsecondframe ? scrh : 0;
 
 		// clear and prepare new chain
-		clearOT(newchain->orderingtable, ENGINE::COMMON::ORDERING_TABLE_SIZE);
+		clearOT(newchain->orderingtable, ENGINE::CONST::ORDERING_TABLE_SIZE);
 		newchain->nextpacket = newchain->data;
 
+		// the first packet at z 0 is the last one the gpu gets to, its irq
+		// says the frame is drawn (the dma finishes well before that)
+		allocatePacket(0, 1)[0] = gp0_irq();
+
 		// add gpu commands to clear buffer and set drawing origin to new chain
 		// z is set to (ORDERING_TABLE_SIZE - 1) so they're executed before anything else
-		auto ptr = allocatePacket(ENGINE::COMMON::ORDERING_TABLE_SIZE - 1, 7);
+		auto ptr = allocatePacket(ENGINE::CONST::ORDERING_TABLE_SIZE - 1, 7);
 		ptr[0]   = gp0_texpage(0, true, false);
 		ptr[1]   = gp0_fbOffset1(bufx, bufy);
 		ptr[2]   = gp0_fbOffset2(bufx + scrw -  1, bufy + scrh - 2);
@@ -106,6 +117,11 @@ namespace ENGINE::PSX {
 		
 	void PSXRenderer::endFrame(void) {
 		auto oldchain = getCurrentChain();
+		auto timer    = g_timerInstance.get();
+
+		cputime = uint32_t(timer->ticksToUS(timer->getTicks() - framestart));
+		if (autodivisor)
+			updateFrameDivisor();
 
 		// switch active chain
 		usingsecondframe = !usingsecondframe;
@@ -121,10 +137,20 @@ namespace ENGINE::PSX {
 
 		// terminate and start drawing current chain
 		*(oldchain->nextpacket) = gp0_endTag(0);
-		sendLinkedList(&(oldchain->orderingtable)[ENGINE::COMMON::ORDERING_TABLE_SIZE - 1]);
+		waitForDMADone();
+		gpustart = timer->getTicks();
+		sendLinkedList(&(oldchain->orderingtable)[ENGINE::CONST::ORDERING_TABLE_SIZE - 1]);
+	}
+
+	void PSXRenderer::setFrameDivisor(uint32_t divisor) {
+		autodivisor = !divisor;
+		if (divisor)
+			framedivisor = divisor;
+
+		overbudget = underbudget = 0;
 	}
 
-	void PSXRenderer::drawRect(ENGINE::COMMON::RECT32 rect, uint32_t z, uint32_t col) {
+	void PSXRenderer::drawRect(const ENGINE::COMMON::RECT32 &rect, uint32_t z, uint32_t col) {
 		auto ptr      = allocatePacket(z, 3);
 		ptr[0]        = col | gp0_rectangle(false, false, false); 
 		ptr[1]        = gp0_xy(rect.x, rect.y);       
@@ -138,6 +164,7 @@ namespace ENGINE::PSX {
 	void PSXRenderer::handleVSyncInterrupt(void) {
 		__atomic_signal_fence(__ATOMIC_ACQUIRE);
 		
+		vblankcount++;
 		vsynccounter++;
 		if (vsynccounter >= refreshrate) {
 			fps = framecounter;
@@ -148,6 +175,42 @@ namespace ENGINE::PSX {
 		__atomic_signal_fence(__ATOMIC_RELEASE);
 	}
 
+	void PSXRenderer::handleGPUInterrupt(void) {
+		auto timer = g_timerInstance.get();
+		uint64_t now = timer->getTicks();
+		GPU_GP1 = gp1_acknowledge();
+
+		// the timer irq can't be serviced while we're in here, if it wrapped
+		// just now the count is behind gpustart so skip this sample
+		if (now >= gpustart)
+			gputime = uint32_t(timer->ticksToUS(now - gpustart));
+	}
+
+	// picks how many vblanks a frame may take. dropping the rate happens
+	// quickly, but going back up needs a long run of frames that would also
+	// fit in the faster budget, so a heavy section stays at a steady rate
+	// instead of bouncing between two
+	void PSXRenderer::updateFrameDivisor(void) {
+		uint32_t vblank = 1000000 / refreshrate;
+		uint32_t load   = (cputime > gputime) ? cputime : gputime; //cpu and gpu overlap
+
+		if (load > (vblank * framedivisor)) {
+			underbudget = 0;
+			if ((++overbudget >= ENGINE::CONST::FRAME_DIVISOR_UP) && (framedivisor < ENGINE::CONST::FRAME_DIVISOR_MAX)) {
+				framedivisor++;
+				overbudget = 0;
+			}
+		} else if ((framedivisor > 1) && ((load * 100) < (vblank * (framedivisor - 1) * ENGINE::CONST::FRAME_DIVISOR_HEADROOM))) {
+			overbudget = 0;
+			if (++underbudget >= ENGINE::CONST::FRAME_DIVISOR_DOWN) {
+				framedivisor--;
+				underbudget = 0;
+			}
+		} else {
+			overbudget = underbudget = 0;
+		}
+	}
+
 
 	//helpers
 	static void waitForGP0Ready(void) {
@@ -161,22 +224,28 @@ namespace ENGINE::PSX {
 	}
 
 	void PSXRenderer::waitForVSync(void) {
-		uint32_t lastcounter = vsynccounter;
+		uint32_t lastcounter = vblankcount;
 
 		framecounter++;
 		__atomic_signal_fence(__ATOMIC_RELEASE);
 
-		// wait for up to 25ms (vsync is every 16.6ms at 60hz or every 20ms at 50hz)
-		for (int i = 2500; i > 0; i--) {
+		// wait for a vblank at least framedivisor vblanks after the last flip.
+		// a frame that is already late still waits for a fresh vblank so it
+		// doesn't tear
+		// wait for up to 25ms per vblank (vsync is every 16.6ms at 60hz or every 20ms at 50hz)
+		for (int i = 2500 * framedivisor; i > 0; i--) {
 			__atomic_signal_fence(__ATOMIC_ACQUIRE);
 
-			if (vsynccounter != lastcounter)
+			if ((vblankcount != lastcounter) && ((vblankcount - lastflip) >= framedivisor)) {
+				lastflip = vblankcount;
 				return;
+			}
 
 			delayMicroseconds(10);
 		}
 
 		printf("timeout while waiting for vsync! something has gone horribly wrong\n");
+		lastflip = vblankcount;
 	}
 
 	uint32_t *PSXRenderer::allocatePacket(uint32_t z, size_t numcommands) {
@@ -184,7 +253,7 @@ namespace ENGINE::PSX {
 		auto ptr   = chain->nextpacket;
 
 		// check z index is valid
-		assert((z >= 0) && (z < ENGINE::COMMON::ORDERING_TABLE_SIZE));
+		assert((z >= 0) && (z < ENGINE::CONST::ORDERING_TABLE_SIZE));
 
 		// link new packet into ordering table at specified z index
 		*ptr = gp0_tag(numcommands, reinterpret_cast<void *>(chain->orderingtable[z]));
@@ -192,7 +261,7 @@ namespace ENGINE::PSX {
 
 		// bump up allocator and check we haven't run out of space
 		chain->nextpacket += numcommands + 1;
-		assert(chain->nextpacket < &(chain->data)[ENGINE::COMMON::CHAIN_BUFFER_SIZE]);
+		assert(chain->nextpacket < &(chain->data)[ENGINE::CONST::CHAIN_BUFFER_SIZE]);
 
 		return &ptr[1];
 	}
@@ -6,24 +6,54 @@ namespace ENGINE::PSX {
 
     constexpr int TIMER2_FREQ = F_CPU / 8;
 
+    // the R3000 has no 64-bit divide, so instead of dividing by the timer
+    // frequency the tick count is multiplied by a precomputed 32.32 reciprocal.
+    // this only takes two 32x32 multiplies (one if the count fits in 32 bits).
+    // the reciprocal is rounded up so whole seconds never come out one short
+    static constexpr uint32_t reciprocal(uint64_t unitspersecond) {
+        return uint32_t(((unitspersecond << 32) + TIMER2_FREQ - 1) / TIMER2_FREQ);
+    }
+
+    static constexpr uint64_t scaleTicks(uint64_t ticks, uint32_t factor) {
+        uint32_t hi = uint32_t(ticks >> 32);
+        uint32_t lo = uint32_t(ticks);
+
+        return (uint64_t(hi) * factor) + ((uint64_t(lo) * factor) >> 32);
+    }
+
+    constexpr uint32_t TICKS_TO_US = reciprocal(1000000);
+    constexpr uint32_t TICKS_TO_MS = reciprocal(1000);
+    static_assert(scaleTicks(TIMER2_FREQ, TICKS_TO_US) == 1000000);
+    static_assert(scaleTicks(TIMER2_FREQ, TICKS_TO_MS) == 1000);
+
     PSXTimer::PSXTimer(void) {
         t2irqcount = 0;
-        TIMER_CTRL(2) = TIMER_CTRL_IRQ_ON_OVERFLOW 
-                    | TIMER_CTRL_IRQ_REPEAT 
+        TIMER_CTRL(2) = TIMER_CTRL_IRQ_ON_OVERFLOW
+                    | TIMER_CTRL_IRQ_REPEAT
                     | TIMER_CTRL_PRESCALE;         // clock source = 2 (SysClk/8)
     }
 
-    uint64_t PSXTimer::getMS(void) {
-        constexpr int tmult = 5;
-        constexpr int tdiv  = 21168;
-        static_assert(((TIMER2_FREQ * tmult) / tdiv) == 1000);
+    uint64_t PSXTimer::getTicks(void) {
+        uint32_t count, value;
+
+        // the overflow irq may fire between reading the counter and reading
+        // the irq count, so retry until both were read within the same period
+        do {
+            __atomic_signal_fence(__ATOMIC_ACQUIRE);
+            count = t2irqcount;
+            value = TIMER_VALUE(2) & 0xffff;
+            __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        } while (count != t2irqcount);
+
+        return uint64_t(value) | (uint64_t(count) << 16);
+    };
 
-        return (getT2_value() * uint64_t(tmult)) / uint64_t(tdiv);
+    uint64_t PSXTimer::ticksToUS(uint64_t ticks) {
+        return scaleTicks(ticks, TICKS_TO_US);
     };
 
-    uint64_t PSXTimer::getT2_value(void) {
-        __atomic_signal_fence(__ATOMIC_ACQUIRE);
-        return uint64_t(TIMER_VALUE(2) & 0xffff) | (uint64_t(t2irqcount) << 16);
+    uint64_t PSXTimer::ticksToMS(uint64_t ticks) {
+        return scaleTicks(ticks, TICKS_TO_MS);
     };
 
-} //namespace ENGINE::PSX 
\ No newline at end of file
+} //namespace ENGINE::PSX
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once 
 
 #include "common.hpp"
+#include "constants.hpp"
+#include <stddef.h>
 #ifdef PLATFORM_PSX
 
 #else
@@ -25,13 +27,28 @@ namespace ENGINE {
 		virtual void setClearCol(uint8_t r, uint8_t g, uint8_t b) {}
 		uint32_t getFPS(void) {return fps;}
 
+		// present a new frame every n vblanks (1 = full rate, 2 = half...),
+		// 0 picks n automatically from how long the last frames took
+		virtual void setFrameDivisor(uint32_t divisor) {}
+		uint32_t getFrameDivisor(void) {return framedivisor;}
+		bool isFrameDivisorAuto(void) {return autodivisor;}
+		// time spent building the last frame and drawing it, in microseconds
+		uint32_t getCPUTime(void) {return cputime;}
+		uint32_t getGPUTime(void) {return gputime;}
+
+		// a file changed on disk (hot reload on pc), reload it if it's ours
+		virtual void onFileChanged(const char *path) {}
+
 		static Renderer &instance();
 
 	protected:
 		uint32_t scrw, scrh;
 		uint32_t refreshrate, fps; //todo populate on gl render
 		uint32_t vsynccounter, framecounter; //todo populate on gl render
-		Renderer() {}
+		uint32_t framedivisor;
+		bool autodivisor;
+		uint32_t cputime, gputime;
+		Renderer() : framedivisor(1), autodivisor(false), cputime(0), gputime(0) {}
 	};
 
 	extern TEMPLATES::ServiceLocator<Renderer> g_rendererInstance;
@@ -41,8 +58,8 @@ namespace ENGINE {
 	namespace PSX {
 			
 		struct DMAChain {
-			uint32_t data[ENGINE::COMMON::CHAIN_BUFFER_SIZE];
-			uint32_t orderingtable[ENGINE::COMMON::ORDERING_TABLE_SIZE];
+			uint32_t data[ENGINE::CONST::CHAIN_BUFFER_SIZE];
+			uint32_t orderingtable[ENGINE::CONST::ORDERING_TABLE_SIZE];
 			uint32_t *nextpacket;
 		};
 
@@ -63,14 +80,22 @@ namespace ENGINE {
 			void setClearCol(uint8_t r, uint8_t g, uint8_t b) {
 				clearcol = (b << 16) | (g << 8) | r; 
 			}
+			void setFrameDivisor(uint32_t divisor);
 		
 			void handleVSyncInterrupt(void); //for irqs
+			void handleGPUInterrupt(void);
 		private:
 			uint32_t clearcol;
 			bool usingsecondframe;
 			DMAChain dmachains[2];
 
+			// frame pacing state, vblankcount never wraps back like vsynccounter
+			uint32_t vblankcount, lastflip;
+			uint64_t framestart, gpustart;
+			uint32_t overbudget, underbudget;
+
 			void waitForVSync(void);
+			void updateFrameDivisor(void);
 			uint32_t *allocatePacket(uint32_t z, size_t numcommands);
 
 			DMAChain *getCurrentChain(void) {
@@ -84,7 +109,8 @@ namespace ENGINE {
 			
 		struct GLShader {
 		public:
-			void init(const char *path, GLenum type);
+			// false (with the log printed) if it didn't compile
+			bool init(const char *path, GLenum type);
 			uint32_t getId(void) {return id;}
 			void free(void) {glDeleteShader(id);}
 		private:
@@ -107,12 +133,18 @@ namespace ENGINE {
 			void setClearCol(uint8_t r, uint8_t g, uint8_t b) {
 				glClearColor(r/255.0f, g/255.0f, b/255.0f, 1.0f);
 			}
+			void setFrameDivisor(uint32_t divisor);
+			void onFileChanged(const char *path);
 	
 		private:
 			SDL_Window* window;
+			uint64_t framestart, lastpresent;
 			GLShader vertshader;
 			GLShader fragshader;
 			uint32_t shaderprog;
+
+			// swaps shaderprog for a freshly built one, keeps the old one on errors
+			bool buildProgram(void);
 		};
 
 	} //namespace GENERIC
@@ -14,4 +14,35 @@ namespace ENGINE {
         return *instance;
     }
 
+    void FixedStepScheduler::reset(void) {
+        lastticks = g_timerInstance.get()->getTicks();
+        accumulator = 0;
+    }
+
+    uint32_t FixedStepScheduler::advance(void) {
+        auto timer = g_timerInstance.get();
+        uint64_t now = timer->getTicks();
+        uint64_t elapsed = timer->ticksToUS(now - lastticks);
+        lastticks = now;
+
+        // anything past maxsteps gets thrown away below anyway, clamping here
+        // just keeps the multiply in 32 bits after a long stall (loading etc)
+        uint32_t limit = ((maxsteps + 1) * ONE_STEP) / rate;
+        if (elapsed > limit)
+            elapsed = limit;
+
+        accumulator += uint32_t(elapsed) * rate;
+
+        uint32_t steps = accumulator / ONE_STEP;
+        accumulator -= steps * ONE_STEP;
+
+        // we can't keep up, slow the game down instead of spiraling
+        if (steps > maxsteps) {
+            droppedsteps += steps - maxsteps;
+            steps = maxsteps;
+        }
+
+        return steps;
+    }
+
 } //namespace ENGINE
\ No newline at end of file
@@ -1,13 +1,21 @@
-#pragma once 
+#pragma once
 
 #include "templates.hpp"
+#include "constants.hpp"
 #include <stdint.h>
 
 namespace ENGINE {
 
     class Timer {
     public:
-        virtual uint64_t getMS(void) {return 0;}
+        // raw counter value, in platform specific units. this is the cheapest
+        // way to timestamp something, convert differences with ticksToUS()
+        virtual uint64_t getTicks(void) {return 0;}
+        virtual uint64_t ticksToUS(uint64_t ticks) {return 0;}
+        virtual uint64_t ticksToMS(uint64_t ticks) {return 0;}
+
+        uint64_t getUS(void) {return ticksToUS(getTicks());}
+        uint64_t getMS(void) {return ticksToMS(getTicks());}
 
         static Timer &instance();
 
@@ -17,6 +25,37 @@ namespace ENGINE {
 
     extern TEMPLATES::ServiceLocator<Timer> g_timerInstance;
 
+    // accumulates real time and hands it out in fixed size steps, so the
+    // simulation runs at the same speed at 50hz, 60hz or when dropping frames
+    class FixedStepScheduler {
+    public:
+        FixedStepScheduler(uint32_t _rate = CONST::FIXED_STEP_RATE, uint32_t _maxsteps = CONST::FIXED_STEP_MAX_STEPS)
+            : rate(_rate), maxsteps(_maxsteps), lastticks(0), accumulator(0), droppedsteps(0) {}
+
+        // restart from now, call after loading or switching scenes
+        void reset(void);
+        // returns how many steps to simulate this frame (at most maxsteps)
+        uint32_t advance(void);
+
+        // fraction of a step left over after advance(), 0 to GTE_ONE
+        int32_t getAlpha(void) const {
+            return int32_t((accumulator * CONST::GTE_ONE) / ONE_STEP);
+        }
+        uint32_t getRate(void) const {return rate;}
+        uint32_t getStepUS(void) const {return ONE_STEP / rate;}
+        uint32_t getDroppedSteps(void) const {return droppedsteps;}
+
+    private:
+        // the accumulator holds elapsed microseconds multiplied by the rate,
+        // so a step is exactly 1/rate seconds and rounding never drifts
+        static constexpr uint32_t ONE_STEP = 1000000;
+
+        uint32_t rate, maxsteps;
+        uint64_t lastticks;
+        uint32_t accumulator;
+        uint32_t droppedsteps;
+    };
+
     //psx
 #ifdef PLATFORM_PSX
     namespace PSX {
@@ -25,10 +64,9 @@ namespace ENGINE {
             uint32_t t2irqcount;
 
             PSXTimer(void);
-            uint64_t getMS(void);
-        private:
-            uint64_t getT2_value(void); 
-
+            uint64_t getTicks(void);
+            uint64_t ticksToUS(uint64_t ticks);
+            uint64_t ticksToMS(uint64_t ticks);
         };
     } //namespace PSX
 #else
@@ -36,7 +74,9 @@ namespace ENGINE {
         class ChronoTimer : public Timer {
         public:
             ChronoTimer(void);
-            uint64_t getMS(void);
+            uint64_t getTicks(void);
+            uint64_t ticksToUS(uint64_t ticks);
+            uint64_t ticksToMS(uint64_t ticks);
         private:
         };
     } //namespace GENERIC
@@ -3,21 +3,65 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "engine/filesystem.hpp"
 #include "engine/assetmanager.hpp"
 #include "engine/timer.hpp"
 #include "engine/renderer.hpp"
+#include "engine/audio.hpp"
 
+#ifdef PLATFORM_PSX
 #include "engine/psx/irq.hpp"
 #include "engine/psx/cd.hpp"
+#endif
 
 APP g_app;
 
 #include "scenes/test.hpp"
 
+#ifdef PLATFORM_PSX
+static const char *BUNDLE_PATH = "ASSETS.XBNL";
+#else
+static const char *BUNDLE_PATH = ASSET_OUTPUT_DIR "/assets.xbnl";
+#endif
+
+#ifndef PLATFORM_PSX
+// hot reload. the game loads what makeassets.py wrote, so an edited source
+// asset is converted again and its outputs reload once they're written.
+// their ids are the hash of "assets/<path in the output folder>", same as
+// in the bundle. shaders are read straight from the source tree
+static bool convertAssets = false;
+
+static void onFileChanged(void *arg, const char *path) {
+	static const size_t outputlength = strlen(ASSET_OUTPUT_DIR "/");
+	auto assets = ENGINE::g_assetManagerInstance.get();
+
+	if (!strncmp(path, ASSET_OUTPUT_DIR "/", outputlength)) {
+		const char *name = path + outputlength;
+		if (!strcmp(name, "assets.xbnl")) {
+			if (assets->openBundle(path))
+				printf("reopened %s\n", path);
+			return;
+		}
+
+		char id[256];
+		snprintf(id, sizeof(id), "assets/%s", name);
+		if (assets->reload(ENGINE::HASH::FromString(id), path))
+			printf("reloaded %s\n", id);
+		return;
+	}
+
+	if (strstr(path, ".glsl"))
+		ENGINE::g_rendererInstance.get()->onFileChanged(path);
+	else
+		convertAssets = true;
+}
+#endif
+
 int main(void) {
 
+	ENGINE::g_timerInstance.provide( &ENGINE::Timer::instance()); //cd timeouts need it
 #ifdef PLATFORM_PSX
 	initSerialIO(115200);
 	ENGINE::PSX::initIRQ();
@@ -25,25 +69,61 @@ int main(void) {
 #endif
 	ENGINE::g_fileSystemInstance.provide( &ENGINE::FileSystem::instance()); //must be done after initializing cd drive
 	ENGINE::g_assetManagerInstance.provide( &ENGINE::AssetManager::instance());
+#ifndef PLATFORM_PSX
+	// off the disc image when running on the simulated drive, see FileSystem::instance()
+	if (getenv("PSXRP_IMAGE"))
+		BUNDLE_PATH = "ASSETS.XBNL";
+#endif
+	ENGINE::g_assetManagerInstance.get()->openBundle(BUNDLE_PATH); //ASSETS:: ids from assetmanifest.hpp
 
-	ENGINE::g_timerInstance.provide( &ENGINE::Timer::instance());
 	ENGINE::g_rendererInstance.provide( &ENGINE::Renderer::instance());
+	ENGINE::g_rendererInstance.get()->setFrameDivisor(0); //drop to 30/20fps on its own when needed
+	ENGINE::g_audioInstance.provide( &ENGINE::Audio::instance());
+
+#ifndef PLATFORM_PSX
+	ENGINE::GENERIC::FileWatcher watcher;
+	watcher.watch("assets");
+	watcher.watch(ASSET_OUTPUT_DIR);
+#endif
 
     g_app.curscene.reset(new TestSCN());
+    ENGINE::g_assetManagerInstance.get()->resetStats(); //memory stats are per scene
+    g_app.scheduler.reset();
 
 	while(1) {
 		ENGINE::g_rendererInstance.get()->beginFrame();
 		
 		assert(g_app.curscene);
-     
+
+        // simulate in fixed steps, then draw whatever is left of the current
+        // step as an interpolation factor
+        for (auto steps = g_app.scheduler.advance(); steps > 0; steps--)
+            g_app.curscene->fixedUpdate();
+
         g_app.curscene->update();  
-        g_app.curscene->draw();  
+        g_app.curscene->draw(g_app.scheduler.getAlpha());  
 			
 // 		printf("time %llu\n", ENGINE::g_timerInstance.get()->getMS());		
 //		printf("fps%d\n", ENGINE::g_rendererInstance.get()->getFPS());
 #ifdef PLATFORM_PSX
 //		g_app.renderer.printStringf({5, 5}, 0, "Heap usage: %zu/%zu bytes", getHeapUsage(), _heapLimit-_heapEnd);
 //		printf("Heap usage: %zu/%zu bytes\n", getHeapUsage(), _heapLimit-_heapEnd);
+#endif
+		ENGINE::g_audioInstance.get()->update();
+		ENGINE::g_fileSystemInstance.get()->update(); //async read callbacks
+		ENGINE::g_assetManagerInstance.get()->update(); //background loads
+#ifndef PLATFORM_PSX
+		watcher.poll(&onFileChanged, nullptr);
+		if (convertAssets) {
+			// the game stalls meanwhile, only what changed gets converted
+			convertAssets = false;
+			printf("converting changed assets\n");
+			if (system("python makeassets.py -o \"" ASSET_OUTPUT_DIR "\""))
+				printf("makeassets.py failed\n");
+		}
+#endif
+#ifdef PLATFORM_PSX
+		ENGINE::PSX::g_CDInstance.get()->updateXA();
 #endif
 		ENGINE::g_rendererInstance.get()->endFrame();
 	} 
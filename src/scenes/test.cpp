@@ -16,13 +16,16 @@ TestSCN::TestSCN(void) {
 
 } 
 
-void TestSCN::update(void) {
+void TestSCN::fixedUpdate(void) {
     //testx += 10;
     //car.rot = {0, testx, 45};
+}
+
+void TestSCN::update(void) {
   //  car.update();
 }
 
-void TestSCN::draw(void) {
+void TestSCN::draw(int32_t alpha) {
     //car.render();
 }
 
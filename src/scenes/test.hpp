@@ -5,8 +5,9 @@
 class TestSCN : public ENGINE::COMMON::Scene {
 public:
     TestSCN(void);
+    void fixedUpdate(void);
     void update(void);
-    void draw(void);
+    void draw(int32_t alpha);
     ~TestSCN(void); 
 private:
 //    ENGINE::Object3D car;
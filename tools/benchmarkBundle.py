@@ -0,0 +1,107 @@
+import time
+from argparse import ArgumentParser
+from pathlib  import Path
+if __package__:
+    from .compressLZ import compress, LEVELS
+    from .makeBundle import sectors, ALIGNMENT
+else:
+    from compressLZ import compress, LEVELS
+    from makeBundle import sectors, ALIGNMENT
+
+# how long the converted assets take to come off the disc at each
+# compression level, as a ps1 would load them through AssetManager: whole
+# sectors at 2x, packed ones unpacked a chunk at a time while the drive reads
+# the next. unpacking is estimated from the r3000 at 33.8mhz with no data
+# cache, a byte copy being about a load, a store and the loop with ram wait
+# states, plus the token parsing per sequence. good for comparing levels, not
+# for promising load times
+
+SECTORS_PER_SEC     = 150
+SEEK_SEC            = 0.1 # the drive has to get to the asset first
+CPU_HZ              = 33868800
+CYCLES_PER_BYTE     = 8
+CYCLES_PER_SEQUENCE = 60
+CHUNK_SIZE          = 8 * ALIGNMENT # ASSET_CHUNK_SECTORS
+
+# files makeassets.py puts next to the assets
+SKIP = { "assets.xbnl", ".assetcache.json", "assetmanifest.hpp" }
+
+def count_sequences(packed: bytes) -> int:
+    count, pos = 0, 0
+    while pos < len(packed):
+        token = packed[pos]
+        pos += 1
+        count += 1
+        lit = token >> 4
+        if lit == 15:
+            while packed[pos] == 255:
+                lit += 255
+                pos += 1
+            lit += packed[pos]
+            pos += 1
+        pos += lit
+        if pos >= len(packed):
+            break
+        pos += 2
+        if (token & 15) == 15:
+            while packed[pos] == 255:
+                pos += 1
+            pos += 1
+    return count
+
+# seconds to read and unpack one asset
+def load_time(length: int, packed: bytes | None) -> tuple[float, float]:
+    if packed is None:
+        return SEEK_SEC + sectors(length) / SECTORS_PER_SEC, 0.0
+
+    unpack   = (length * CYCLES_PER_BYTE + count_sequences(packed) * CYCLES_PER_SEQUENCE) / CPU_HZ
+    transfer = sectors(len(packed)) / SECTORS_PER_SEC
+    # every chunk but the last is unpacked while the next is read
+    chunks   = max(1, (len(packed) + CHUNK_SIZE - 1) // CHUNK_SIZE)
+    return SEEK_SEC + max(transfer, unpack) + unpack / chunks, unpack
+
+def main():
+    parser = ArgumentParser(description = "Compares load time and size of the converted assets at each compression level")
+    parser.add_argument("folder", type = Path, help = "makeassets.py output folder")
+    parser.add_argument("-v", "--verbose", action = "store_true", help = "List every asset")
+    args = parser.parse_args()
+
+    files = sorted(f for f in args.folder.rglob("*") if f.is_file() and (f.name not in SKIP))
+    data  = { f: f.read_bytes() for f in files }
+    total = sum(len(d) for d in data.values())
+    if not files:
+        raise SystemExit(f"nothing in {args.folder}, run makeassets.py first")
+
+    print(f"{len(files)} assets, {total // 1024}k")
+    print(f"{'level':<8} {'stored':>9} {'ratio':>7} {'sectors':>8} {'load':>8} {'unpack':>8} {'pack':>8}")
+
+    for level in ["none", *LEVELS]:
+        stored = sectors_ = 0
+        load = unpack = pack = 0.0
+        rows = []
+
+        for f, d in data.items():
+            result = None
+            if level != "none":
+                start = time.perf_counter()
+                result, _ = compress(d, LEVELS[level])
+                pack += time.perf_counter() - start
+                # makeBundle.py only keeps it packed if it saves a sector
+                if sectors(len(result)) >= sectors(len(d)):
+                    result = None
+
+            size = len(result) if result is not None else len(d)
+            seconds, cpu = load_time(len(d), result)
+            stored   += size
+            sectors_ += sectors(size)
+            load     += seconds
+            unpack   += cpu
+            rows.append((f.relative_to(args.folder).as_posix(), len(d), size, seconds))
+
+        print(f"{level:<8} {stored:>9} {stored / max(total, 1):>7.1%} {sectors_:>8} {load:>7.2f}s {unpack:>7.2f}s {pack:>7.2f}s")
+        if args.verbose and (level != "none"):
+            for name, length, size, seconds in rows:
+                print(f"    {name:<40} {length:>9} {size:>9} {seconds:>7.3f}s")
+
+if __name__ == "__main__":
+    main()
@@ -49,6 +49,16 @@ class FontHeader(ctypes.LittleEndianStructure):
     ]
 
 
+class SoundHeader(ctypes.LittleEndianStructure):
+    _pack_ = 1 
+    _fields_ = [
+        ("magic",      ctypes.c_uint32),
+        ("length",     ctypes.c_uint32),
+        ("samplerate", ctypes.c_uint32),
+        ("loopstart",  ctypes.c_uint32)
+    ]
+
+
 class GTEVector16(ctypes.LittleEndianStructure):
     _pack_ = 1 
     _fields_ = [
@@ -81,7 +91,9 @@ class ModelFileHeader(ctypes.LittleEndianStructure):
         ("magic", ctypes.c_uint32), 
         ("numvertices", ctypes.c_uint32),   
         ("numfaces", ctypes.c_uint32),
-        ("numtex", ctypes.c_uint32)
+        ("numtex", ctypes.c_uint32),
+        ("shift", ctypes.c_int32), # vertices are model units * 2^shift
+        ("numlods", ctypes.c_uint32)
     ]
 
 class GTEVector16(ctypes.LittleEndianStructure):
@@ -116,5 +128,18 @@ class ModelFileHeader(ctypes.LittleEndianStructure):
         ("magic", ctypes.c_uint32), 
         ("numvertices", ctypes.c_uint32),   
         ("numfaces", ctypes.c_uint32),
-        ("numtex", ctypes.c_uint32)
+        ("numtex", ctypes.c_uint32),
+        ("shift", ctypes.c_int32), # vertices are model units * 2^shift
+        ("numlods", ctypes.c_uint32)
+    ]
+
+# follows the header, one per lod (finest first). faces of every lod come
+# one after another, lod i uses the first numvertices vertices
+class ModelLOD(ctypes.LittleEndianStructure):
+    _pack_ = 1
+    _fields_ = [
+        ("numvertices", ctypes.c_uint32),
+        ("firstface", ctypes.c_uint32),
+        ("numfaces", ctypes.c_uint32),
+        ("error", ctypes.c_uint32) # how far the surface moved, in vertex units
     ]
@@ -0,0 +1,146 @@
+from argparse import ArgumentParser
+from pathlib  import Path
+
+# lz4 block format, what ENGINE::LZDecoder reads: sequences of a token byte
+# (literal count in the top nibble, match length - 4 in the bottom one, 15
+# meaning more follows as bytes added up until one isn't 255), the literals,
+# then a 16 bit little endian offset back into the output. the last sequence
+# is literals only. byte aligned and no entropy coding, so unpacking is
+# mostly copying, which is about all the r3000 is fast at
+
+MIN_MATCH   = 4
+MAX_OFFSET  = 0xffff
+# lz4's own end of block rules, keeps the data readable by its tools too
+LAST_LITERALS = 5
+MATCH_LIMIT   = 12
+# candidates tried per position, higher packs (a little) better and slower
+LEVELS = {
+    "fast":   1,
+    "normal": 16,
+    "max":    256,
+}
+
+def match_length(data: bytes, a: int, b: int, limit: int) -> int:
+    # compares growing slices instead of byte by byte, far faster in python
+    n, step = 0, 8
+    while n < limit:
+        s = min(step, limit - n)
+        if data[a + n:a + n + s] == data[b + n:b + n + s]:
+            n += s
+            step *= 2
+        elif s == 1:
+            break
+        else:
+            step = max(1, s // 2)
+    return n
+
+def write_length(out: bytearray, n: int):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+def write_sequence(out: bytearray, literals: bytes, offset: int, length: int):
+    lit   = len(literals)
+    match = length - MIN_MATCH if offset else 0
+    out.append((min(lit, 15) << 4) | min(match, 15))
+    if lit >= 15:
+        write_length(out, lit - 15)
+    out += literals
+    if offset:
+        out += offset.to_bytes(2, "little")
+        if match >= 15:
+            write_length(out, match - 15)
+
+# returns (packed, margin). margin is how many bytes past the unpacked length
+# a buffer needs so the packed data can sit at its end and be unpacked over
+# itself: the output must never catch up with the next token still to be read
+def compress(data: bytes, depth: int = LEVELS["normal"]) -> tuple[bytes, int]:
+    out    = bytearray()
+    chains = {}
+    anchor = 0  # first byte not written yet
+    pos    = 0
+    ahead  = 0  # max(bytes out - bytes in) at any sequence boundary
+    end    = len(data) - LAST_LITERALS
+    last   = len(data) - MATCH_LIMIT
+
+    def insert(i):
+        chains.setdefault(data[i:i + MIN_MATCH], []).append(i)
+
+    while pos <= last:
+        best, bestpos = 0, 0
+        for cand in reversed(chains.get(data[pos:pos + MIN_MATCH], [])[-depth:]):
+            if pos - cand > MAX_OFFSET:
+                break
+            n = match_length(data, cand, pos, end - pos)
+            if n > best:
+                best, bestpos = n, cand
+
+        if best < MIN_MATCH:
+            insert(pos)
+            pos += 1
+            continue
+
+        write_sequence(out, data[anchor:pos], pos - bestpos, best)
+        for i in range(pos, min(pos + best, last + 1)):
+            insert(i)
+        pos += best
+        anchor = pos
+        ahead = max(ahead, pos - len(out))
+
+    write_sequence(out, data[anchor:], 0, 0)
+    # the end itself needs none, the output just meets the input there
+    grown = len(data) - len(out)
+    return bytes(out), max(ahead, grown) - grown
+
+# reference decoder, to check the compressor against
+def decompress(packed: bytes, length: int) -> bytes:
+    out = bytearray()
+    pos = 0
+
+    def read_length(n):
+        nonlocal pos
+        if n == 15:
+            while True:
+                b = packed[pos]
+                pos += 1
+                n += b
+                if b != 255:
+                    break
+        return n
+
+    while True:
+        token = packed[pos]
+        pos += 1
+        lit = read_length(token >> 4)
+        out += packed[pos:pos + lit]
+        pos += lit
+        if pos >= len(packed):
+            break
+
+        offset = int.from_bytes(packed[pos:pos + 2], "little")
+        pos += 2
+        match = read_length(token & 15) + MIN_MATCH
+        if not 0 < offset <= len(out):
+            raise ValueError("bad match offset")
+        for _ in range(match):
+            out.append(out[-offset])
+
+    if len(out) != length:
+        raise ValueError(f"unpacked to {len(out)} bytes, expected {length}")
+    return bytes(out)
+
+def main():
+    parser = ArgumentParser(description = "Packs a file in the lz4 block format the engine reads")
+    parser.add_argument("input", type = Path)
+    parser.add_argument("output", type = Path)
+    parser.add_argument("-l", "--level", choices = LEVELS, default = "normal")
+    args = parser.parse_args()
+
+    data = args.input.read_bytes()
+    packed, margin = compress(data, LEVELS[args.level])
+    args.output.write_bytes(packed)
+    print(f"{len(data)} -> {len(packed)} bytes ({len(packed) / max(len(data), 1):.1%}), in place margin {margin}")
+
+if __name__ == "__main__":
+    main()
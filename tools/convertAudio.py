@@ -0,0 +1,255 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+import struct
+from argparse import ArgumentParser, Namespace
+from enum     import IntFlag
+
+import numpy
+from numpy   import ndarray
+from .common import SoundHeader
+
+SAMPLES_PER_BLOCK = 28
+BYTES_PER_BLOCK   = 16
+
+# the spu predicts every sample from the two previously decoded ones, these
+# are the weights (in 1/64 units) of its 5 filters
+FILTER_K0 = ( 0, 60, 115,  98, 122 )
+FILTER_K1 = ( 0,  0, -52, -55, -60 )
+
+class ADPCMFlag(IntFlag):
+	ADPCM_END        = 1 << 0
+	ADPCM_REPEAT     = 1 << 1
+	ADPCM_LOOP_START = 1 << 2
+
+
+## WAV parsing
+
+# the wave module doesn't expose the smpl chunk (and rejects float files), so
+# the riff chunks are walked by hand
+def readWAV(path: str) -> tuple[ndarray, int, tuple[int, int] | None]:
+	with open(path, "rb") as f:
+		data = f.read()
+
+	if data[0:4] != b"RIFF" or data[8:12] != b"WAVE":
+		raise ValueError(f"{path} is not a wav file")
+
+	fmt     = None
+	samples = None
+	loop    = None
+	offset  = 12
+
+	while offset + 8 <= len(data):
+		chunkID, chunkSize = struct.unpack_from("<4sI", data, offset)
+		chunk  = data[offset + 8:offset + 8 + chunkSize]
+		offset += 8 + chunkSize + (chunkSize & 1)
+
+		if chunkID == b"fmt ":
+			fmt = struct.unpack_from("<HHIIHH", chunk)
+		elif chunkID == b"data":
+			samples = chunk
+		elif chunkID == b"smpl" and len(chunk) >= 60:
+			numLoops, = struct.unpack_from("<I", chunk, 28)
+			if numLoops:
+				# end is inclusive in the smpl chunk
+				start, end = struct.unpack_from("<II", chunk, 36 + 8)
+				loop       = ( start, end + 1 )
+
+	if fmt is None or samples is None:
+		raise ValueError(f"{path} is missing the fmt or data chunk")
+
+	format, channels, rate, _, _, bits = fmt
+
+	if format == 3 and bits == 32:
+		pcm = numpy.frombuffer(samples, "<f4") * 32768.0
+	elif format in ( 1, 0xfffe ) and bits == 16:
+		pcm = numpy.frombuffer(samples, "<i2").astype("f8")
+	elif format in ( 1, 0xfffe ) and bits == 8:
+		pcm = (numpy.frombuffer(samples, "B").astype("f8") - 128.0) * 256.0
+	else:
+		raise ValueError(f"{path}: unsupported wav format {format} ({bits} bits)")
+
+	# the spu voices are mono, downmix everything else
+	pcm = pcm[:len(pcm) - (len(pcm) % channels)].reshape((-1, channels)).mean(axis = 1)
+
+	return pcm, rate, loop
+
+def resample(pcm: ndarray, length: int) -> ndarray:
+	if length == len(pcm):
+		return pcm
+
+	positions = numpy.arange(length) * (len(pcm) / length)
+	return numpy.interp(positions, numpy.arange(len(pcm)), pcm)
+
+
+## ADPCM encoding
+
+# picks the best filter candidates for every block at once. this uses the
+# source samples as prediction history, which is close enough to the decoded
+# ones to rank filters and size the shift, the exact quantization is done
+# afterwards in encodeBlock()
+def analyzeBlocks(pcm: ndarray) -> tuple[ndarray, ndarray]:
+	padded = numpy.concatenate(( numpy.zeros(2, "i8"), pcm ))
+	cur    = padded[2:]
+	prev1  = padded[1:-1]
+	prev2  = padded[:-2]
+
+	k0 = numpy.array(FILTER_K0, "i8")[:, None]
+	k1 = numpy.array(FILTER_K1, "i8")[:, None]
+
+	residual = cur[None, :] - ((prev1[None, :] * k0 + prev2[None, :] * k1 + 32) >> 6)
+	maxres   = numpy.abs(residual).reshape((5, -1, SAMPLES_PER_BLOCK)).max(axis = 2)
+
+	# a nibble covers -8..7 steps of 1 << (12 - shift)
+	needed = numpy.ceil(numpy.log2(numpy.maximum(maxres, 1) / 7.5)).astype("i8")
+	shifts = numpy.clip(12 - needed, 0, 12)
+
+	return numpy.argsort(maxres, axis = 0, kind = "stable"), shifts
+
+def encodeBlock(
+	block: list[int], s1: int, s2: int, filter: int, shift: int
+) -> tuple[int, list[int], int, int]:
+	k0, k1  = FILTER_K0[filter], FILTER_K1[filter]
+	step    = 1 << (12 - shift)
+	error   = 0
+	nibbles = []
+
+	for sample in block:
+		pred   = (s1 * k0 + s2 * k1 + 32) >> 6
+		nibble = min(max(round((sample - pred) / step), -8), 7)
+		output = min(max(nibble * step + pred, -0x8000), 0x7fff)
+
+		error += (sample - output) ** 2
+		s2, s1 = s1, output
+		nibbles.append(nibble & 15)
+
+	return error, nibbles, s1, s2
+
+def encodeADPCM(pcm: ndarray, loopBlock: int | None) -> bytearray:
+	pcm          = numpy.clip(numpy.round(pcm), -0x8000, 0x7fff).astype("i8")
+	order, shift = analyzeBlocks(pcm)
+	numBlocks    = len(pcm) // SAMPLES_PER_BLOCK
+
+	output = bytearray(numBlocks * BYTES_PER_BLOCK)
+	s1, s2 = 0, 0
+
+	for index in range(numBlocks):
+		block = pcm[index * SAMPLES_PER_BLOCK:(index + 1) * SAMPLES_PER_BLOCK].tolist()
+
+		if index == loopBlock:
+			# the history differs between the first pass and every loop
+			# around, filter 0 doesn't use it so both decode the same
+			candidates = [ ( 0, shift[0, index] ) ]
+		else:
+			best, second = order[0, index], order[1, index]
+			candidates   = [
+				( best,   shift[best, index] ),
+				( best,   max(shift[best, index] - 1, 0) ),
+				( second, shift[second, index] )
+			]
+
+		result = None
+		for filter, blockShift in candidates:
+			encoded = encodeBlock(block, s1, s2, int(filter), int(blockShift))
+			if result is None or encoded[0] < result[0][0]:
+				result = ( encoded, int(filter), int(blockShift) )
+
+		( _, nibbles, s1, s2 ), filter, blockShift = result
+
+		flags = 0
+		if index == loopBlock:
+			flags |= ADPCMFlag.ADPCM_LOOP_START
+		if index == numBlocks - 1:
+			flags |= ADPCMFlag.ADPCM_END
+			if loopBlock is not None:
+				flags |= ADPCMFlag.ADPCM_REPEAT
+
+		offset = index * BYTES_PER_BLOCK
+		output[offset + 0] = blockShift | (filter << 4)
+		output[offset + 1] = flags
+		for i in range(0, SAMPLES_PER_BLOCK, 2):
+			output[offset + 2 + i // 2] = nibbles[i] | (nibbles[i + 1] << 4)
+
+	return output
+
+
+## Main
+
+def convert_audio(wav_path: str, output_path: str, rate: int | None = None):
+	"""
+	Convert a wav file to spu adpcm and write it to output file.
+
+	Parameters:
+	- wav_path: path to input wav, loop points are taken from its smpl chunk
+	- output_path: path to output binary file
+	- rate: optional sample rate to downsample to
+	"""
+
+	pcm, srcRate, loop = readWAV(wav_path)
+
+	if rate and rate != srcRate:
+		length = max(round(len(pcm) * rate / srcRate), 1)
+		if loop:
+			loop = ( round(loop[0] * length / len(pcm)), round(loop[1] * length / len(pcm)) )
+		pcm     = resample(pcm, length)
+		srcRate = rate
+
+	loopBlock = None
+
+	if loop:
+		start, end = loop
+		if not (0 <= start < end <= len(pcm)):
+			raise ValueError(f"{wav_path}: loop points out of range")
+
+		# anything after the loop end is never heard
+		pcm = pcm[:end]
+
+		# loops can only jump between blocks, so stretch the sound until the
+		# loop is a whole number of blocks (adjusting the rate to keep the
+		# pitch) and pad the start until the loop begins on a block
+		loopLength = end - start
+		newLength  = -(-loopLength // SAMPLES_PER_BLOCK) * SAMPLES_PER_BLOCK
+
+		if newLength != loopLength:
+			scale   = newLength / loopLength
+			pcm     = resample(pcm, round(len(pcm) * scale))
+			start   = len(pcm) - newLength
+			srcRate = round(srcRate * scale)
+
+		padding   = -start % SAMPLES_PER_BLOCK
+		pcm       = numpy.concatenate(( numpy.zeros(padding), pcm ))
+		loopBlock = (start + padding) // SAMPLES_PER_BLOCK
+	else:
+		pcm = numpy.concatenate(( pcm, numpy.zeros(-len(pcm) % SAMPLES_PER_BLOCK) ))
+
+	data = encodeADPCM(pcm, loopBlock)
+
+	header            = SoundHeader()
+	header.magic      = int.from_bytes(b"XSND", byteorder="little")
+	header.length     = len(data)
+	header.samplerate = srcRate
+	header.loopstart  = 0xffffffff if loopBlock is None else loopBlock * SAMPLES_PER_BLOCK
+
+	with open(output_path, "wb") as f:
+		f.write(header)
+		f.write(data)
+
+def createParser() -> ArgumentParser:
+	parser = ArgumentParser(
+		description = "Converts a wav file into spu adpcm data with loop flags."
+	)
+
+	parser.add_argument("input", help = "Path to input wav file")
+	parser.add_argument("output", help = "Path to .xsnd file to generate")
+	parser.add_argument("-r", "--rate", type = int, help = "Resample to the given rate")
+
+	return parser
+
+def main():
+	parser: ArgumentParser = createParser()
+	args: Namespace = parser.parse_args()
+
+	convert_audio(args.input, args.output, args.rate)
+
+if __name__ == "__main__":
+	main()
@@ -188,7 +188,7 @@ def convert_image(img_path: str, vram_path: str, output_path: str, force_stp: bo
 
     Parameters:
     - img_path: path to input image
-    - vram_path: path to VRAM text file
+    - vram_path: path to VRAM text file, or its values as placed by makeAtlas
     - output_path: path to output binary file
     - force_stp: bool
     """
@@ -197,10 +197,13 @@ def convert_image(img_path: str, vram_path: str, output_path: str, force_stp: bo
     input_image = Image.open(img_path)
 
     # --- Load VRAM ---
-    with open(vram_path, "r") as f:
-        vram = f.read().split()
+    if isinstance(vram_path, (list, tuple)):
+        vram = list(vram_path)
+    else:
+        with open(vram_path, "r") as f:
+            vram = f.read().split()
 
-    vram = [eval(value) for value in vram]
+        vram = [eval(value) for value in vram]
 
     bpp = vram[4]
 
@@ -228,10 +231,17 @@ def convert_image(img_path: str, vram_path: str, output_path: str, force_stp: bo
     if (vram[2] + clutData.size) > 1024:
         raise ValueError("Palette clipping vram")
 
-    info.page = gp0_page(vram[0] // 64, vram[1] // 256, 0, colordepth)
+    # atlas placements also say where their page starts, so every texture in
+    # it uses the same one. hand placed textures use the page they start in
+    if len(vram) >= 7:
+        page_x, page_y = vram[5], vram[6]
+    else:
+        page_x, page_y = vram[0] // 64 * 64, vram[1] // 256 * 256
+
+    info.page = gp0_page(page_x // 64, page_y // 256, 0, colordepth)
     info.clut = gp0_clut(vram[2] // 16, vram[3])
-    info.u = (vram[0] % 64) * width_divider
-    info.v = vram[1] % 256
+    info.u = (vram[0] - page_x) * width_divider
+    info.v = vram[1] - page_y
     info.w = image.size[0]
     info.h = image.size[1]
     info.bpp = bpp
@@ -2,14 +2,30 @@ import sys
 import ctypes
 import struct
 import os 
-import re
+import math
 from PIL import Image
-from common import GTEVector16, Face, TexHeader, ModelFileHeader
-
+from .common import GTEVector16, Face, TexHeader, ModelFileHeader, ModelLOD
+from .simplifyModel import make_lods
+
+# same layouts as GTEVector16 and Face, packing plain tuples is a lot faster
+# than filling in a ctypes struct for every vertex and face
+VERTEX = struct.Struct("<4h")
+FACE = struct.Struct("<4hI4B4Bi")
+assert VERTEX.size == ctypes.sizeof(GTEVector16) and FACE.size == ctypes.sizeof(Face)
+
+# positions are stored as round(coord * 2^shift) with the largest shift that
+# keeps them under this. a rotated vertex can get up to sqrt(3) times longer
+# on one axis, the headroom keeps it inside the gte's 16 bit ir registers
+VERTEX_LIMIT = 0x3fff
+# transformed vertices a renderer can keep around (eg. in the scratchpad),
+# the face order is optimized for a cache this big
+VERTEX_CACHE_SIZE = 32
+
+# obj polygons go around the edge, the gpu draws a quad as the triangles
+# 0 1 2 and 1 2 3
 def reorder_z_shape(indices):
-    print(indices)
     if (len(indices) == 4):
-        return [indices[0], indices[1], indices[2], indices[3]]
+        return [indices[0], indices[1], indices[3], indices[2]]
     elif (len(indices) == 3):
         return [indices[0], indices[1], indices[2], -1]  # Pad triangle
     else:
@@ -31,119 +47,289 @@ class Material:
 def error(txt):
     print(txt, file=sys.stderr)
     sys.exit(1)
-    
-    def convert_model(input_path, output_path, texture_dir):
+
+def parse_mtl(mtl_path, materials, textures):
+    curmat = None
+    with open(mtl_path, 'r') as fmtl:
+        for line in fmtl:
+            data = line.split()
+            if not data:
+                continue
+
+            if data[0] == "newmtl":
+                curmat = Material()
+                curmat.name = data[1]
+                materials.append(curmat)
+
+            elif curmat and data[0] == "Kd":
+                curmat.setcol(data[1], data[2], data[3])
+
+            elif curmat and data[0] == "map_Kd":
+                texpath = data[1]
+                textures.append(texpath)
+                curmat.texture = texpath
+                curmat.texid = textures.index(texpath)
+
+def find_shift(vertices):
+    extent = max((abs(c) for v in vertices for c in v), default=0.0)
+    shift = 15
+    while (shift > -16) and (round(math.ldexp(extent, shift)) > VERTEX_LIMIT):
+        shift -= 1
+    return shift
+
+# quantizes the positions and merges vertices that end up in the same spot.
+# a quad that loses a corner because of it becomes a triangle, faces left
+# with fewer than 3 corners are dropped
+def weld(vertices, faces, shift):
+    unique = {}
+    remap = []
+    for v in vertices:
+        q = tuple(round(math.ldexp(c, shift)) for c in v)
+        remap.append(unique.setdefault(q, len(unique)))
+
+    welded = []
+    for f in faces:
+        # corners in the order they go around the edge, quads are z shaped
+        corners = []
+        for i in ((0, 1, 3, 2) if f[3] >= 0 else (0, 1, 2)):
+            if all(remap[f[i]] != remap[f[j]] for j in corners):
+                corners.append(i)
+
+        if len(corners) < 3:
+            continue
+        if len(corners) == 4:
+            corners = [0, 1, 2, 3]
+
+        u, v = f[5:9], f[9:13]
+        pad = [-1] * (4 - len(corners))
+        welded.append((
+            *[remap[f[i]] for i in corners], *pad,
+            f[4],
+            *[u[i] for i in corners], *[0] * len(pad),
+            *[v[i] for i in corners], *[0] * len(pad),
+            *f[13:]
+        ))
+
+    return list(unique), welded
+
+# tipsify (sander et al. 2007): fans out around a vertex, then moves on to a
+# neighbour that's still in the cache, so consecutive faces mostly share
+# vertices. linear time, returns the new order as indices into faces
+def tipsify(faces, numvertices, cachesize):
+    adjacency = [[] for _ in range(numvertices)]
+    for i, f in enumerate(faces):
+        for v in f[:4]:
+            if v >= 0:
+                adjacency[v].append(i)
+
+    live = [len(a) for a in adjacency]
+    stamp = [0] * numvertices
+    emitted = [False] * len(faces)
+    deadend = []
+    order = []
+    time = cachesize + 1
+    cursor = 0
+    fan = faces[0][0] if faces else -1
+
+    while fan >= 0:
+        candidates = []
+        for i in adjacency[fan]:
+            if emitted[i]:
+                continue
+            emitted[i] = True
+            order.append(i)
+
+            for v in faces[i][:4]:
+                if v < 0:
+                    continue
+                deadend.append(v)
+                candidates.append(v)
+                live[v] -= 1
+                if time - stamp[v] > cachesize:
+                    stamp[v] = time
+                    time += 1
+
+        # the candidate that stays cached longest while its remaining faces
+        # get emitted, otherwise the most recent vertex with faces left
+        fan, best = -1, -1
+        for v in candidates:
+            if live[v] <= 0:
+                continue
+            priority = (time - stamp[v]) if (time - stamp[v] + 2 * live[v] <= cachesize) else 0
+            if priority > best:
+                fan, best = v, priority
+
+        while (fan < 0) and deadend:
+            v = deadend.pop()
+            if live[v] > 0:
+                fan = v
+
+        while (fan < 0) and (cursor < numvertices):
+            if live[cursor] > 0:
+                fan = cursor
+            cursor += 1
+
+    return order
+
+# faces are grouped by texture page and clut so the renderer switches gpu
+# state once per group, untextured ones first. each group is then ordered
+# for vertex reuse
+def order_faces(faces, numvertices, texkeys):
+    groups = {}
+    for f in faces:
+        groups.setdefault(texkeys.get(f[-1], (-1, -1)), []).append(f)
+
+    ordered = []
+    for key in sorted(groups):
+        group = groups[key]
+        ordered += [group[i] for i in tipsify(group, numvertices, VERTEX_CACHE_SIZE)]
+    return ordered, len(groups)
+
+# the vertices are renumbered in the order faces first use them, so
+# transforming them is a mostly sequential walk. the coarsest lod's come
+# first and every finer lod appends the ones it adds, so each lod only has
+# to transform a prefix of the array. returns the vertices, the renumbered
+# lods and how many vertices each lod uses
+def optimize(vertices, lods, texkeys):
+    lods = [order_faces(faces, len(vertices), texkeys)[0] for faces in lods]
+
+    renumber = [-1] * len(vertices)
+    used = []
+    counts = []
+    for faces in reversed(lods):
+        for f in faces:
+            for v in f[:4]:
+                if (v >= 0) and (renumber[v] < 0):
+                    renumber[v] = len(used)
+                    used.append(vertices[v])
+        counts.insert(0, len(used))
+
+    lods = [[(*(renumber[v] if v >= 0 else -1 for v in f[:4]), *f[4:]) for f in faces] for faces in lods]
+    return used, lods, counts
+
+def convert_model(input_path, output_path, texture_dir):
     materials = []
+    bymat = {} # name -> first material with that name, for usemtl
     vertices = []
     uvs = []
     faces = []
     textures = []
+    texinfos = {} # xtex path -> texinfo, each header is read once
+    texkeys = {} # texid -> (page, clut)
 
-    # open obj
-    with open(input_path, 'r') as fin:
-        content = fin.read()
-
-    # find mtl
-    match = re.search(r"mtllib\s+(.+\.mtl)", content)
-    mtl_file = match.group(1) if match else None
-    print("material file:", mtl_file)
-
-    # parse MTL
-    if mtl_file is not None:
-        mtl_path = os.path.join(os.path.dirname(input_path), mtl_file)
-        with open(mtl_path, 'r') as fmtl:
-            curmat = None
-            for line in fmtl:
-                data = line.split()
-                if not data:
-                    continue
-
-                if data[0] == "newmtl":
-                    if curmat is not None:
-                        materials.append(curmat)
-                    curmat = Material()
-                    curmat.name = data[1]
+    def texture_info(mat):
+        texname = os.path.splitext(mat.texture)[0] + ".xtex"
+        texpath = os.path.join(texture_dir, texname)
 
-                elif curmat and data[0] == "Kd":
-                    curmat.setcol(data[1], data[2], data[3])
+        if texpath not in texinfos:
+            with open(texpath, 'rb') as tex:
+                texinfos[texpath] = TexHeader.from_buffer_copy(tex.read(ctypes.sizeof(TexHeader))).texinfo
 
-                elif curmat and data[0] == "map_Kd":
-                    texpath = data[1]
-                    textures.append(texpath)
-                    curmat.texture = texpath
-                    curmat.texid = textures.index(texpath)
+        return texinfos[texpath]
 
-            if curmat:
-                materials.append(curmat)
+    # obj indices are 1 based, negative ones count back from the last element
+    def resolve(token, count):
+        i = int(token)
+        return i - 1 if i > 0 else count + i
 
-    # parse OBJ
+    # everything in one pass over the obj, the mtl is parsed when it's referenced
     curmat = None
+    color, texid, texrect = 0x808080, -1, None
     with open(input_path, 'r') as fin:
         for line in fin:
             data = line.split()
             if not data:
                 continue
-
-            if data[0] == "v":
-                v = GTEVector16()
-                v.x = int(float(data[1]) * 32)
-                v.y = int(float(data[2]) * 32)
-                v.z = int(float(data[3]) * 32)
-                vertices.append(v)
-
-            elif data[0] == "vt":
-                u = float(data[1])
-                v = 1.0 - float(data[2])
-                uvs.append([u, v])
-
-            elif data[0] == "usemtl":
-                curmat = next((m for m in materials if m.name == data[1]), None)
-
-            elif data[0] == "f":
-                f = Face()
-                matches = re.findall(r'(\d+)(?:/(\d*)/?(\d*))?\s*', line)
-
-                vert_indices = [int(v) - 1 for v, vt, vn in matches if v]
-                f.indices[:] = reorder_z_shape(vert_indices)
-
-                if curmat is not None:
-                    f.color = curmat.color
-
-                    if curmat.texid >= 0:
-                        texname = os.path.splitext(curmat.texture)[0] + ".xtex"
-                        texpath = os.path.join(texture_dir, texname)
-
-                        with open(texpath, 'rb') as tex:
-                            data = tex.read(ctypes.sizeof(TexHeader))
-                            texheader = TexHeader.from_buffer_copy(data)
-
-                        width = texheader.texinfo.w - 1
-                        height = texheader.texinfo.h - 1
-
-                        uv_indices = [int(vt) - 1 for v, vt, vn in matches if vt]
-                        uv_indices = reorder_z_shape(uv_indices)
-
-                        f.u[:] = [int(uvs[i][0] * width) for i in uv_indices]
-                        f.v[:] = [int(uvs[i][1] * height) for i in uv_indices]
-                        f.texid = curmat.texid
-
-                faces.append(f)
+            cmd = data[0]
+
+            if cmd == "v":
+                vertices.append((float(data[1]), float(data[2]), float(data[3])))
+
+            elif cmd == "vt":
+                uvs.append((float(data[1]), 1.0 - float(data[2])))
+
+            elif cmd == "f":
+                vert_indices = []
+                uv_indices = []
+                for corner in data[1:]:
+                    refs = corner.split('/')
+                    vert_indices.append(resolve(refs[0], len(vertices)))
+                    if len(refs) > 1 and refs[1]:
+                        uv_indices.append(resolve(refs[1], len(uvs)))
+
+                vert_indices = reorder_z_shape(vert_indices)
+
+                if texrect is not None:
+                    x, y, width, height = texrect
+                    uv_indices = reorder_z_shape(uv_indices)
+                    u = [x + int(uvs[i][0] * width) for i in uv_indices]
+                    v = [y + int(uvs[i][1] * height) for i in uv_indices]
+                else:
+                    u = v = (0, 0, 0, 0)
+
+                faces.append((*vert_indices, color, *u, *v, texid))
+
+            elif cmd == "usemtl":
+                curmat = bymat.get(data[1])
+                color = curmat.color if curmat else 0x808080
+                texid = curmat.texid if curmat else -1
+                texrect = None
+                if texid >= 0:
+                    texinfo = texture_info(curmat)
+                    # uvs are relative to the page, the texture may share it
+                    texrect = (texinfo.u, texinfo.v, texinfo.w - 1, texinfo.h - 1)
+                    texkeys[texid] = (texinfo.page, texinfo.clut)
+
+            elif cmd == "mtllib":
+                mtl_file = line.split(maxsplit=1)[1].strip()
+                print("material file:", mtl_file)
+
+                parse_mtl(os.path.join(os.path.dirname(input_path), mtl_file), materials, textures)
+                for mat in materials:
+                    bymat.setdefault(mat.name, mat)
+
+    shift = find_shift(vertices)
+    numparsed = len(vertices)
+    vertices, faces = weld(vertices, faces, shift)
+    numgroups = order_faces(faces, len(vertices), texkeys)[1]
+
+    lods = make_lods(vertices, faces)
+    errors = [error for _, error in lods]
+    vertices, lods, counts = optimize(vertices, [f for f, _ in lods], texkeys)
+
+    print(f"{os.path.basename(input_path)}: {len(vertices)} of {numparsed} vertices, {len(lods[0])} faces in {numgroups} texture groups, scale 2^{shift}")
+    for i, faces in enumerate(lods[1:], 1):
+        print(f"  lod {i}: {counts[i]} vertices, {len(faces)} faces, error {errors[i]}")
+
+    # faces index vertices with int16
+    if len(vertices) > 0x8000:
+        raise ValueError(f"{len(vertices)} vertices, a model can have at most {0x8000}")
 
     # write output
     with open(output_path, 'wb') as fout:
         header = ModelFileHeader()
         header.magic = int.from_bytes(b"XMDL", byteorder="little")
         header.numvertices = len(vertices)
-        header.numfaces = len(faces)
+        header.numfaces = sum(len(faces) for faces in lods)
         header.numtex = len(textures)
+        header.shift = shift
+        header.numlods = len(lods)
 
         fout.write(header)
 
-        for v in vertices:
-            fout.write(v)
-
-        for f in faces:
-            fout.write(f)
+        firstface = 0
+        for faces, count, error in zip(lods, counts, errors):
+            lod = ModelLOD()
+            lod.numvertices = count
+            lod.firstface = firstface
+            lod.numfaces = len(faces)
+            lod.error = error
+            fout.write(lod)
+            firstface += len(faces)
+
+        fout.write(b"".join(VERTEX.pack(*v, 0) for v in vertices))
+        for faces in lods:
+            fout.write(b"".join(FACE.pack(*f) for f in faces))
 
         if header.numtex > 0:
             for mat in materials:
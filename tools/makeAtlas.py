@@ -0,0 +1,176 @@
+import json
+from argparse import ArgumentParser
+from pathlib  import Path
+from PIL      import Image
+from .convertImage import quantizeImage, convertIndexedImage
+
+# a scene file (any name ending in .atlas) packs every png below its folder
+# that has no hand placed .vram file into shared texture pages. it says which
+# part of vram the scene may use, in halfwords, eg.
+#
+#   pages 320 0 576 512   # x y w h, x a multiple of 64 and y of 256
+#   cluts 0 480 320 32    # x y w h, x a multiple of 16
+#
+# textures are packed at the lowest bit depth their colors fit in, 4bpp pages
+# are 64x256 halfwords and 8bpp ones 128x256 (256x256 texels either way).
+# textures with identical cluts share one
+
+SLOT_WIDTH  = 64  # halfwords between texture page bases
+PAGE_HEIGHT = 256
+
+def read_scene(path: Path) -> dict[str, tuple[int, int, int, int]]:
+    scene = {}
+    for line in path.read_text().splitlines():
+        data = line.split("#", 1)[0].split()
+        if not data:
+            continue
+        if (data[0] not in ("pages", "cluts")) or (len(data) != 5):
+            raise SystemExit(f"{path}: expected pages/cluts x y w h, got {line.strip()!r}")
+        scene[data[0]] = tuple(int(v) for v in data[1:])
+
+    for key in ("pages", "cluts"):
+        if key not in scene:
+            raise SystemExit(f"{path}: missing {key}")
+
+    x, y, w, h = scene["pages"]
+    if (x % SLOT_WIDTH) or (w % SLOT_WIDTH) or (y % PAGE_HEIGHT) or (h % PAGE_HEIGHT):
+        raise SystemExit(f"{path}: pages must be aligned to {SLOT_WIDTH}x{PAGE_HEIGHT}")
+    if scene["cluts"][0] % 16:
+        raise SystemExit(f"{path}: cluts x must be a multiple of 16")
+    return scene
+
+# skyline bottom left packing inside one texture page
+class Page:
+    def __init__(self, x: int, y: int, width: int, bpp: int):
+        self.x, self.y, self.bpp = x, y, bpp
+        self.width = width
+        self.skyline = [(0, 0, width)] # (x, y, width) segments left to right
+
+    def insert(self, w: int, h: int) -> tuple[int, int] | None:
+        best = None
+        for i, (sx, _, _) in enumerate(self.skyline):
+            if sx + w > self.width:
+                break
+
+            # highest segment under the span
+            top, covered, j = 0, 0, i
+            while covered < w:
+                top = max(top, self.skyline[j][1])
+                covered += self.skyline[j][2]
+                j += 1
+
+            if (top + h <= PAGE_HEIGHT) and ((best is None) or (top + h, sx) < (best[0] + h, best[1])):
+                best = (top, sx)
+
+        if best is None:
+            return None
+
+        top, sx = best
+        segments = []
+        for x, y, width in self.skyline:
+            end = x + width
+            if end <= sx or x >= sx + w:
+                segments.append((x, y, width))
+                continue
+            if x < sx:
+                segments.append((x, y, sx - x))
+            if end > sx + w:
+                segments.append((sx + w, y, end - sx - w))
+        segments.append((sx, top + h, w))
+        segments.sort()
+
+        # merge neighbours at the same height
+        self.skyline = []
+        for seg in segments:
+            if self.skyline and (self.skyline[-1][1] == seg[1]):
+                x, y, width = self.skyline[-1]
+                self.skyline[-1] = (x, y, width + seg[2])
+            else:
+                self.skyline.append(seg)
+
+        return sx, top
+
+# what a png turns into, needed before anything can be placed
+def load_texture(path: Path) -> tuple[int, int, int, bytes]:
+    source = Image.open(path)
+    try:
+        image, bpp = quantizeImage(source, 16), 4
+    except RuntimeError:
+        image, bpp = quantizeImage(source, 256), 8
+
+    data, clut = convertIndexedImage(image)
+    # rows are padded to whole halfwords by the conversion
+    return data.shape[1] // 2, data.shape[0], bpp, clut.tobytes()
+
+# returns png -> [x, y, clutx, cluty, bpp, pagex, pagey], the same values as
+# a .vram file plus where the page the texture is drawn from starts
+def make_atlas(scene: dict, textures: list[Path]) -> dict[Path, list[int]]:
+    px, py, pw, ph = scene["pages"]
+    free = [(x, y) for y in range(py, py + ph, PAGE_HEIGHT) for x in range(px, px + pw, SLOT_WIDTH)]
+
+    def allocate(bpp: int) -> Page:
+        slots = 1 if bpp == 4 else 2
+        for x, y in free:
+            if all((x + i * SLOT_WIDTH, y) in free for i in range(slots)):
+                for i in range(slots):
+                    free.remove((x + i * SLOT_WIDTH, y))
+                return Page(x, y, slots * SLOT_WIDTH, bpp)
+        return None
+
+    loaded = { path: load_texture(path) for path in textures }
+
+    # the biggest 8bpp ones first, while there are still free slot pairs
+    order = sorted(textures, key = lambda p: (-loaded[p][2], -loaded[p][1], -loaded[p][0], str(p)))
+    pages = []
+    placements = {}
+
+    for path in order:
+        w, h, bpp, _ = loaded[path]
+        if (w > SLOT_WIDTH * (bpp // 4)) or (h > PAGE_HEIGHT):
+            raise SystemExit(f"{path} is bigger than a texture page")
+
+        for page in pages:
+            if (page.bpp == bpp) and ((pos := page.insert(w, h)) is not None):
+                break
+        else:
+            page = allocate(bpp)
+            if page is None:
+                raise SystemExit(f"out of texture pages packing {path}, make the scene's pages area bigger")
+            pages.append(page)
+            pos = page.insert(w, h)
+
+        placements[path] = [page.x + pos[0], page.y + pos[1], 0, 0, bpp, page.x, page.y]
+
+    # identical cluts are stored once, 256 color ones go first so they
+    # don't end up with no row wide enough left
+    cx, cy, cw, ch = scene["cluts"]
+    rows = [cx] * ch
+    clutpos = {}
+    for clut in sorted({ loaded[p][3] for p in textures }, key = lambda c: (-len(c), c)):
+        width = len(clut) // 2
+        for row in range(ch):
+            if rows[row] + width <= cx + cw:
+                clutpos[clut] = (rows[row], cy + row)
+                rows[row] += width
+                break
+        else:
+            raise SystemExit("out of clut space, make the scene's cluts area bigger")
+
+    for path in textures:
+        placements[path][2:4] = clutpos[loaded[path][3]]
+
+    used = sum(page.width for page in pages) * PAGE_HEIGHT
+    print(f"Packed {len(textures)} textures into {len(pages)} pages ({used // 1024}k halfwords) with {len(clutpos)} cluts")
+    return placements
+
+def main():
+    parser = ArgumentParser(description = "Packs textures into the vram pages of a scene")
+    parser.add_argument("scene", type = Path, help = "Scene .atlas file")
+    parser.add_argument("textures", type = Path, nargs = "+", help = "Textures to pack")
+    args = parser.parse_args()
+
+    placements = make_atlas(read_scene(args.scene), args.textures)
+    print(json.dumps({ str(p): v for p, v in placements.items() }, indent = 1))
+
+if __name__ == "__main__":
+    main()
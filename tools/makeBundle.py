@@ -1,5 +1,17 @@
 import ctypes
-import struct
+import os
+import re
+from argparse import ArgumentParser
+from pathlib  import Path
+# imported by makeassets.py as part of tools, or run on its own
+if __package__:
+    from .compressLZ import compress, LEVELS
+else:
+    from compressLZ import compress, LEVELS
+
+# entries start on a sector boundary so the cd can dma them straight into
+# the destination buffer
+ALIGNMENT = 2048
 
 class Header(ctypes.LittleEndianStructure):
     _pack_ = 1
@@ -12,10 +24,13 @@ class File(ctypes.LittleEndianStructure):
     _pack_ = 1
     _fields_ = [
         ("filename", ctypes.c_uint32),
-        ("length", ctypes.c_uint32),
-        ("offset", ctypes.c_uint64),
+        ("offset", ctypes.c_uint32),
+        ("length", ctypes.c_uint32), # unpacked
+        ("packed", ctypes.c_uint32), # 0 if stored as is
+        ("margin", ctypes.c_uint32), # for unpacking in place, see compressLZ.py
     ]
 
+# same fnv-1a as ENGINE::HASH and the _h literal
 def hash(s: str) -> int:
     hash_ = 0x811C9DC5
     prime = 0x01000193
@@ -24,44 +39,131 @@ def hash(s: str) -> int:
         hash_ &= 0xFFFFFFFF
     return hash_
 
-filenames = ["assets/hi1.txt", "assets/hi2.txt"]
-with open("assetbundle", "wb") as out:
-    header = Header()
-    header.magic = int.from_bytes(b"XBNL", byteorder="little")
-    # Write file count
-    numfiles = len(filenames)
-    header.numfiles = numfiles
-    out.write(bytes(header))
-
-    # Track offset and entries
-    offset = numfiles * ctypes.sizeof(File) + ctypes.sizeof(Header)
-    entries = []
-
-    # Write data and build entries
-    for fn in filenames:
-        with open(fn, "rb") as f:
-            data = f.read()
-
-        entry = File()
-        entry.filename = hash(fn)
-        entry.length = len(data)
-        entry.offset = offset
-        entries.append(entry)
-
-        out.seek(offset)
-        out.write(data)
-
-        # Align
-        while out.tell() % 4:
-            print("padding")
-            out.write(b'\x00')
-            offset += 1
-
-
-        offset += len(data)
-            
-
-    # Write file table
-    out.seek(ctypes.sizeof(Header)) #skip header
-    for entry in entries:
-        out.write(bytes(entry))
\ No newline at end of file
+# "assets/cars/car.xtex" becomes ASSETS::CARS_CAR_XTEX
+def constant_name(name: str) -> str:
+    ident = re.sub(r"[^0-9A-Za-z]", "_", name.removeprefix("assets/")).upper()
+    return f"_{ident}" if ident[0].isdigit() else ident
+
+def check_duplicates(names: list[str]):
+    ids    = {}
+    consts = {}
+    for name in names:
+        id_ = hash(name)
+        if id_ in ids and ids[id_] != name:
+            raise SystemExit(f"asset id collision: {ids[id_]} and {name} both hash to {id_:#010x}, rename one of them")
+        ids[id_] = name
+
+        const = constant_name(name)
+        if const in consts and consts[const] != name:
+            raise SystemExit(f"asset name collision: {consts[const]} and {name} both become {const}")
+        consts[const] = name
+
+# the drive reads whole sectors, packing only pays off if it saves some
+def sectors(length: int) -> int:
+    return (length + ALIGNMENT - 1) // ALIGNMENT
+
+# files maps the name the game asks for (and hashes) to the file on disk.
+# returns (id, name, offset, length, packed) for every entry, sorted by id as
+# in the bundle's table so the runtime can binary search it. level None
+# stores everything as is
+def make_bundle(files: dict[str, Path], output_path: Path, level: str | None = "normal") -> list[tuple[int, str, int, int, int]]:
+    names = sorted(files, key=hash)
+    check_duplicates(names)
+
+    # written next to it and renamed over it, a running game may have the
+    # old one mapped (hot reload)
+    temp_path = output_path.with_name(f".{output_path.name}.tmp")
+    with open(temp_path, "wb") as out:
+        header = Header()
+        header.magic = int.from_bytes(b"XBNL", byteorder="little")
+        header.numfiles = len(names)
+        out.write(bytes(header))
+
+        offset  = ctypes.sizeof(Header) + len(names) * ctypes.sizeof(File)
+        entries = []
+
+        for name in names:
+            with open(files[name], "rb") as f:
+                data = f.read()
+
+            packed, margin = compress(data, LEVELS[level]) if level else (data, 0)
+            if sectors(len(packed)) >= sectors(len(data)):
+                packed, margin = data, 0
+
+            offset = (offset + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+            out.seek(offset)
+            out.write(packed)
+
+            entries.append((hash(name), name, offset, len(data), len(packed) if packed is not data else 0, margin))
+            offset += len(packed)
+
+        # keep the file a whole number of sectors
+        out.truncate((offset + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT)
+
+        out.seek(ctypes.sizeof(Header))
+        for id_, _, offset, length, packed, margin in entries:
+            entry = File()
+            entry.filename = id_
+            entry.offset = offset
+            entry.length = length
+            entry.packed = packed
+            entry.margin = margin
+            out.write(bytes(entry))
+
+    os.replace(temp_path, output_path)
+    return [e[:5] for e in entries]
+
+def write_manifest(entries: list[tuple[int, str, int, int, int]], output_path: Path):
+    lines = [
+        "// generated by makeassets.py, do not edit",
+        "#pragma once",
+        "",
+        "#include <stdint.h>",
+        "",
+        "namespace ASSETS {",
+        "    struct ManifestEntry {",
+        "        uint32_t id, offset, length, packed; // packed is 0 if stored as is",
+        "    };",
+        "",
+    ]
+
+    width = max((len(constant_name(e[1])) for e in entries), default=0)
+    for id_, name, *_ in sorted(entries, key=lambda e: e[1]):
+        lines.append(f"    constexpr uint32_t {constant_name(name):<{width}} = {id_:#010x}; // {name}")
+
+    lines += [
+        "",
+        "    // same order as the bundle's table (by id)",
+        f"    constexpr uint32_t NUM_ENTRIES = {len(entries)};",
+        "    constexpr ManifestEntry MANIFEST[] = {",
+    ]
+    for id_, name, offset, length, packed in entries:
+        lines.append(f"        {{ {id_:#010x}, {offset:>9}, {length:>9}, {packed:>9} }}, // {name}")
+    lines += [
+        "    };",
+        "} //namespace ASSETS",
+        ""
+    ]
+
+    # left alone when nothing changed so the game isn't recompiled for nothing
+    text = "\n".join(lines)
+    if output_path.is_file() and (output_path.read_text() == text):
+        return False
+
+    output_path.write_text(text)
+    return True
+
+def main():
+    parser = ArgumentParser(description = "Packs files into an XBNL bundle")
+    parser.add_argument("-o", "--output", type = Path, required = True, help = "Output bundle")
+    parser.add_argument("-m", "--manifest", type = Path, help = "Also write a manifest header here")
+    parser.add_argument("-l", "--level", choices = [*LEVELS, "none"], default = "normal", help = "Compression, none stores everything as is")
+    parser.add_argument("files", type = Path, nargs = "+", help = "Files to pack, named by their path as given")
+    args = parser.parse_args()
+
+    entries = make_bundle({ f.as_posix(): f for f in args.files }, args.output, None if args.level == "none" else args.level)
+    if args.manifest:
+        write_manifest(entries, args.manifest)
+
+if __name__ == "__main__":
+    main()
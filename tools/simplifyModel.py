@@ -0,0 +1,199 @@
+import heapq
+import math
+
+# faces are the tuples convertModel builds: 4 indices (z shaped, -1 pads a
+# triangle), color, 4 u, 4 v, texid
+
+# every lod after the full mesh has about this fraction of the previous one's
+# triangles (a quad counts as two), until there's too little left to bother
+LOD_LEVELS = 3
+LOD_RATIO = 0.5
+LOD_MIN_TRIANGLES = 32
+# lods are for objects that can be far away as a whole, anything bigger
+# (a whole track) is always partly close and would take long to simplify
+LOD_MAX_TRIANGLES = 20000
+# boundary edges get a plane perpendicular to their face weighted this much,
+# so open borders (wheel arches, windows) don't get eaten away
+BOUNDARY_WEIGHT = 16.0
+
+# corners in order around the polygon, as (vertex, u, v)
+def corners(f):
+    order = (0, 1, 3, 2) if f[3] >= 0 else (0, 1, 2)
+    return [(f[i], f[5 + i], f[9 + i]) for i in order]
+
+def to_face(c, color, texid):
+    if len(c) == 4:
+        c = [c[0], c[1], c[3], c[2]]
+    else:
+        c = c + [(-1, 0, 0)]
+    return (*(x[0] for x in c), color, *(x[1] for x in c), *(x[2] for x in c), texid)
+
+def triangles(f):
+    return 2 if f[3] >= 0 else 1
+
+def sub(a, b):
+    return (a[0] - b[0], a[1] - b[1], a[2] - b[2])
+
+def cross(a, b):
+    return (a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0])
+
+def dot(a, b):
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]
+
+# newell's method, works for triangles and (non planar) quads alike
+def normal(points):
+    n = [0.0, 0.0, 0.0]
+    for i, p in enumerate(points):
+        q = points[(i + 1) % len(points)]
+        n[0] += (p[1] - q[1]) * (p[2] + q[2])
+        n[1] += (p[2] - q[2]) * (p[0] + q[0])
+        n[2] += (p[0] - q[0]) * (p[1] + q[1])
+    return n
+
+# a quadric is the symmetric 4x4 matrix of a sum of squared plane distances,
+# stored as its upper triangle
+def plane_quadric(n, p, weight = 1.0):
+    length = math.sqrt(dot(n, n))
+    if length == 0:
+        return None
+    a, b, c = n[0] / length, n[1] / length, n[2] / length
+    d = -(a * p[0] + b * p[1] + c * p[2])
+    return [weight * x for x in (a * a, a * b, a * c, a * d, b * b, b * c, b * d, c * c, c * d, d * d)]
+
+def add_quadric(q, r):
+    for i in range(10):
+        q[i] += r[i]
+
+def evaluate(q, p):
+    x, y, z = p
+    return (
+        q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x +
+        q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y +
+        q[7] * z * z + 2 * q[8] * z +
+        q[9]
+    )
+
+# quadric edge collapse (garland & heckbert) restricted to collapsing a vertex
+# into one of its neighbours, so every lod only uses a subset of the full
+# mesh's vertices and they can all share one vertex array. returns
+# [(faces, error)], the full mesh first with error 0. error is roughly how far
+# (in vertex units) the surface moved: the distance of the worst collapse so
+# far from the original faces around it, boundary planes left out
+def make_lods(vertices, faces, levels = LOD_LEVELS, ratio = LOD_RATIO):
+    lods = [(faces, 0)]
+    numtris = sum(triangles(f) for f in faces)
+    if (levels <= 0) or (numtris < LOD_MIN_TRIANGLES) or (numtris > LOD_MAX_TRIANGLES):
+        return lods
+
+    polys = [corners(f) for f in faces]
+    attrs = [(f[4], f[-1]) for f in faces]
+    alive = [True] * len(polys)
+    vfaces = [set() for _ in vertices]
+    for i, c in enumerate(polys):
+        for v, _, _ in c:
+            vfaces[v].add(i)
+
+    quadrics = [[0.0] * 10 for _ in vertices]
+    planes = [[0.0] * 10 for _ in vertices] # faces only, for the error
+    edges = {}
+    for i, c in enumerate(polys):
+        points = [vertices[v] for v, _, _ in c]
+        n = normal(points)
+        q = plane_quadric(n, points[0])
+        if q is None:
+            continue
+        for v, _, _ in c:
+            add_quadric(quadrics[v], q)
+            add_quadric(planes[v], q)
+        for j in range(len(c)):
+            a, b = c[j][0], c[(j + 1) % len(c)][0]
+            edges.setdefault((min(a, b), max(a, b)), []).append((i, a, b))
+
+    for users in edges.values():
+        if len(users) != 1:
+            continue
+        i, a, b = users[0]
+        n = normal([vertices[v] for v, _, _ in polys[i]])
+        q = plane_quadric(cross(sub(vertices[b], vertices[a]), n), vertices[a], BOUNDARY_WEIGHT)
+        if q is not None:
+            add_quadric(quadrics[a], q)
+            add_quadric(quadrics[b], q)
+
+    removed = [False] * len(vertices)
+    stamp = [0] * len(vertices)
+    heap = []
+
+    def neighbours(v):
+        result = set()
+        for i in vfaces[v]:
+            result.update(x for x, _, _ in polys[i])
+        result.discard(v)
+        return result
+
+    def push(a, b):
+        q = [x + y for x, y in zip(quadrics[a], quadrics[b])]
+        heapq.heappush(heap, (evaluate(q, vertices[b]), a, b, stamp[a], stamp[b]))
+
+    # collapsing a into b mustn't turn any of the faces around a over
+    def flips(a, b):
+        for i in vfaces[a]:
+            c = polys[i]
+            if any(v == b for v, _, _ in c):
+                continue
+            before = [vertices[v] for v, _, _ in c]
+            after = [vertices[b] if v == a else vertices[v] for v, _, _ in c]
+            if dot(normal(before), normal(after)) <= 0:
+                return True
+        return False
+
+    def collapse(a, b):
+        nonlocal numtris
+        for i in vfaces[a]:
+            old = polys[i]
+            c = [(b, u, v) if x == a else (x, u, v) for x, u, v in old]
+            c = [p for j, p in enumerate(c) if p[0] != c[j - 1][0]]
+
+            numtris -= len(old) - 2
+            if len(c) < 3:
+                alive[i] = False
+                for v, _, _ in old:
+                    if v != a:
+                        vfaces[v].discard(i)
+                continue
+
+            polys[i] = c
+            numtris += len(c) - 2
+            vfaces[b].add(i)
+
+        vfaces[a] = set()
+        removed[a] = True
+        add_quadric(quadrics[b], quadrics[a])
+        add_quadric(planes[b], planes[a])
+        stamp[b] += 1
+        for n in neighbours(b):
+            push(n, b)
+            push(b, n)
+
+    for a in range(len(vertices)):
+        for b in neighbours(a):
+            push(a, b)
+
+    worst = 0.0
+    for _ in range(levels):
+        target = max(int(numtris * ratio), 1)
+        before = numtris
+
+        while heap and (numtris > target):
+            cost, a, b, sa, sb = heapq.heappop(heap)
+            if removed[a] or removed[b] or (stamp[a] != sa) or (stamp[b] != sb):
+                continue
+            if flips(a, b):
+                continue
+            worst = max(worst, evaluate([x + y for x, y in zip(planes[a], planes[b])], vertices[b]))
+            collapse(a, b)
+
+        if (numtris == before) or (numtris < LOD_MIN_TRIANGLES // 2):
+            break
+        lods.append(([to_face(polys[i], *attrs[i]) for i in range(len(polys)) if alive[i]], math.ceil(math.sqrt(max(worst, 0.0)))))
+
+    return lods